@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Bump allocator: allocations are carved out of a chain of blocks and are
+ * only released all at once by arena_finish().
+ */
+
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block {
+	struct arena_block *next;
+	size_t len, cap;
+};
+
+static size_t align(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static char *block_data(struct arena_block *block) {
+	return (char *)block + align(sizeof(*block));
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = align(size > 0 ? size : 1);
+
+	struct arena_block *block = arena->blocks;
+	if (block == NULL || block->cap - block->len < size) {
+		// Double the block size as the arena grows
+		size_t cap = block != NULL ? 2 * block->cap : ARENA_BLOCK_SIZE;
+		while (cap < size) {
+			cap *= 2;
+		}
+		block = malloc(align(sizeof(*block)) + cap);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->next = arena->blocks;
+		block->len = 0;
+		block->cap = cap;
+		arena->blocks = block;
+	}
+
+	void *ptr = block_data(block) + block->len;
+	block->len += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+char *arena_strdup(struct arena *arena, const char *str) {
+	size_t size = strlen(str) + 1;
+	char *copy = arena_alloc(arena, size);
+	if (copy != NULL) {
+		memcpy(copy, str, size);
+	}
+	return copy;
+}
+
+void arena_finish(struct arena *arena) {
+	struct arena_block *block = arena->blocks;
+	while (block != NULL) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
@@ -0,0 +1,244 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Layout checks done before a configuration is sent, so that mistakes are
+ * reported without a roundtrip to the compositor (and a modeset).
+ */
+
+bool parse_arrange(const char *value, enum randr_arrange *arrange) {
+	if (strcmp(value, "left-to-right") == 0) {
+		*arrange = RANDR_ARRANGE_LEFT_TO_RIGHT;
+	} else if (strcmp(value, "grid") == 0) {
+		*arrange = RANDR_ARRANGE_GRID;
+	} else {
+		log_error("invalid arrangement: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+// The scale as received by the compositor
+static double sent_scale(const struct randr_head *head) {
+	return wl_fixed_to_double(wl_fixed_from_double(head->scale));
+}
+
+static bool get_head_resolution(const struct randr_head *head,
+		int32_t *width, int32_t *height) {
+	if (head->mode != NULL) {
+		*width = head->mode->width;
+		*height = head->mode->height;
+	} else if (head->custom_mode.width > 0 && head->custom_mode.height > 0) {
+		*width = head->custom_mode.width;
+		*height = head->custom_mode.height;
+	} else {
+		return false;
+	}
+
+	if (head->transform % 2 != 0) {
+		int32_t tmp = *width;
+		*width = *height;
+		*height = tmp;
+	}
+	return true;
+}
+
+bool get_head_box(const struct randr_head *head, struct randr_box *box) {
+	int32_t width, height;
+	double scale = sent_scale(head);
+	if (!head->enabled || !get_head_resolution(head, &width, &height) ||
+			scale <= 0) {
+		return false;
+	}
+
+	// Truncated like wlr_output_effective_resolution() does
+	box->x = head->x;
+	box->y = head->y;
+	box->width = width / scale;
+	box->height = height / scale;
+	return true;
+}
+
+static bool boxes_overlap(const struct randr_box *a, const struct randr_box *b) {
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+		a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+// Overlapping or sharing part of an edge
+static bool boxes_touch(const struct randr_box *a, const struct randr_box *b) {
+	return a->x <= b->x + b->width && b->x <= a->x + a->width &&
+		a->y <= b->y + b->height && b->y <= a->y + a->height &&
+		((a->x < b->x + b->width && b->x < a->x + a->width) ||
+		(a->y < b->y + b->height && b->y < a->y + a->height));
+}
+
+static bool check_head(const struct randr_head *head) {
+	if (!head->enabled) {
+		return true;
+	}
+
+	if (wl_fixed_from_double(head->scale) <= 0) {
+		log_error("invalid scale for %s: %f, must be positive\n",
+			head->name, head->scale);
+		return false;
+	}
+
+	if (head->mode == NULL && (head->changed & RANDR_HEAD_MODE) &&
+			(head->custom_mode.width <= 0 || head->custom_mode.height <= 0 ||
+			head->custom_mode.refresh < 0)) {
+		log_error("invalid custom mode for %s: %dx%d@%d mHz\n", head->name,
+			head->custom_mode.width, head->custom_mode.height,
+			head->custom_mode.refresh);
+		return false;
+	}
+
+	int32_t width, height;
+	double scale = sent_scale(head);
+	if ((head->changed & (RANDR_HEAD_MODE | RANDR_HEAD_SCALE)) &&
+			get_head_resolution(head, &width, &height) &&
+			(fmod(width, scale) > 0 || fmod(height, scale) > 0)) {
+		log_error("warning: scale %f gives %s a fractional logical size of "
+			"%.3fx%.3f\n", head->scale, head->name,
+			width / scale, height / scale);
+	}
+
+	return true;
+}
+
+bool check_layout(struct randr_state *state) {
+	size_t len = 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!check_head(head)) {
+			return false;
+		}
+		len++;
+	}
+
+	struct {
+		struct randr_head *head;
+		struct randr_box box;
+		size_t group;
+	} *items = calloc(len + 1, sizeof(*items));
+	if (items == NULL) {
+		log_error("failed to allocate layout\n");
+		return false;
+	}
+
+	size_t n = 0;
+	wl_list_for_each(head, &state->heads, link) {
+		if (get_head_box(head, &items[n].box)) {
+			items[n].head = head;
+			items[n].group = n;
+			n++;
+		}
+	}
+
+	// Identical boxes are assumed to be mirrors
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = i + 1; j < n; j++) {
+			if (boxes_overlap(&items[i].box, &items[j].box) &&
+					memcmp(&items[i].box, &items[j].box,
+						sizeof(items[i].box)) != 0) {
+				log_error("warning: %s and %s overlap\n",
+					items[i].head->name, items[j].head->name);
+			}
+		}
+	}
+
+	// Merge touching heads into groups until nothing changes
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = i + 1; j < n; j++) {
+				if (items[i].group != items[j].group &&
+						boxes_touch(&items[i].box, &items[j].box)) {
+					size_t group = items[i].group < items[j].group ?
+						items[i].group : items[j].group;
+					items[i].group = items[j].group = group;
+					merged = true;
+				}
+			}
+		}
+	}
+	for (size_t i = 1; i < n; i++) {
+		if (items[i].group != 0) {
+			log_error("warning: %s is not adjacent to %s, "
+				"the layout has a gap\n",
+				items[i].head->name, items[0].head->name);
+		}
+	}
+
+	free(items);
+	return true;
+}
+
+void auto_arrange(struct randr_state *state, enum randr_arrange arrange) {
+	size_t len = 0;
+	struct randr_box box;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (get_head_box(head, &box)) {
+			len++;
+		}
+	}
+
+	// Column count for the grid, rows are filled first
+	size_t cols = len;
+	if (arrange == RANDR_ARRANGE_GRID) {
+		cols = 1;
+		while (cols * cols < len) {
+			cols++;
+		}
+	}
+	size_t rows = cols > 0 ? (len + cols - 1) / cols : 0;
+
+	int32_t *col_x = calloc(cols + 1, sizeof(*col_x));
+	int32_t *row_y = calloc(rows + 1, sizeof(*row_y));
+	if (col_x == NULL || row_y == NULL) {
+		free(col_x);
+		free(row_y);
+		log_error("failed to allocate layout\n");
+		return;
+	}
+
+	// Each column is as wide as its widest head, and each row as high as
+	// its highest head
+	size_t i = 0;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!get_head_box(head, &box)) {
+			continue;
+		}
+		size_t col = i % cols, row = i / cols;
+		if (col_x[col + 1] < box.width) {
+			col_x[col + 1] = box.width;
+		}
+		if (row_y[row + 1] < box.height) {
+			row_y[row + 1] = box.height;
+		}
+		i++;
+	}
+	for (size_t col = 1; col <= cols; col++) {
+		col_x[col] += col_x[col - 1];
+	}
+	for (size_t row = 1; row <= rows; row++) {
+		row_y[row] += row_y[row - 1];
+	}
+
+	i = 0;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!get_head_box(head, &box)) {
+			continue;
+		}
+		head->x = col_x[i % cols];
+		head->y = row_y[i / cols];
+		head->changed |= RANDR_HEAD_POSITION;
+		i++;
+	}
+
+	free(col_x);
+	free(row_y);
+}
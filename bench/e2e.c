@@ -0,0 +1,410 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 50
+#define SOCKET "wayland-bench"
+
+/*
+ * Starts the mock compositor in a private runtime directory for each
+ * scenario, runs wlr-randr against it repeatedly and reports the latency of
+ * whole invocations, from fork to exit. The command pipe is measured per
+ * command instead, over one invocation. Cached queries must be answered
+ * without the compositor.
+ */
+
+struct scenario {
+	const char *name;
+	const char *mock_args[8];
+	const char *randr_args[8];
+	int exit_code;
+};
+
+static const struct scenario scenarios[] = {
+	{
+		.name = "query, 4 heads",
+		.mock_args = { "--heads", "4", "--modes", "16" },
+	},
+	{
+		.name = "query, 128 heads",
+		.mock_args = { "--heads", "128", "--modes", "300" },
+	},
+	{
+		.name = "json query, 128 heads",
+		.mock_args = { "--heads", "128", "--modes", "300" },
+		.randr_args = { "--json" },
+	},
+	{
+		.name = "apply, 4 heads",
+		.mock_args = { "--heads", "4", "--modes", "16" },
+		.randr_args = { "--output", "HEAD-1", "--pos", "1920,0" },
+	},
+	{
+		// HEAD-1 is already there
+		.name = "re-assert, --no-op-skip",
+		.mock_args = { "--heads", "4", "--modes", "16" },
+		.randr_args = { "--no-op-skip", "--output", "HEAD-1", "--pos", "1920,0" },
+	},
+	{
+		.name = "apply, 20 ms modeset",
+		.mock_args = { "--heads", "4", "--modes", "16", "--delay", "20" },
+		.randr_args = { "--output", "HEAD-1", "--pos", "1920,0" },
+	},
+	{
+		// Only the first run tests, the layout is known to work afterwards
+		.name = "apply, 20 ms modeset, --test-then-apply",
+		.mock_args = { "--heads", "4", "--modes", "16", "--delay", "20" },
+		.randr_args = { "--test-then-apply", "--output", "HEAD-1",
+			"--pos", "1920,0" },
+	},
+	{
+		.name = "apply, every other one cancelled",
+		.mock_args = { "--heads", "4", "--modes", "16", "--cancel-every", "2" },
+		.randr_args = { "--output", "HEAD-1", "--pos", "1920,0" },
+	},
+	{
+		// Rejected before connecting
+		.name = "invalid scale",
+		.mock_args = { "--heads", "4", "--modes", "16" },
+		.randr_args = { "--output", "HEAD-1", "--scale", "abc" },
+		.exit_code = EXIT_FAILURE,
+	},
+	{
+		.name = "apply, failing",
+		.mock_args = { "--heads", "4", "--modes", "16", "--fail-every", "1" },
+		.randr_args = { "--output", "HEAD-1", "--pos", "1920,0" },
+		.exit_code = EXIT_FAILURE,
+	},
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static pid_t spawn_with_input(const char *path, const char *const args[],
+		int in, int out) {
+	const char *argv[16] = { path };
+	size_t argc = 1;
+	for (size_t i = 0; args[i] != NULL && argc < 15; i++) {
+		argv[argc++] = args[i];
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_RDWR);
+		dup2(in >= 0 ? in : null, STDIN_FILENO);
+		dup2(out >= 0 ? out : null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(path, (char *const *)argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+static pid_t spawn(const char *path, const char *const args[], int out) {
+	return spawn_with_input(path, args, -1, out);
+}
+
+// Returns once the compositor accepts connections
+static pid_t start_mock(const char *path, const struct scenario *scenario) {
+	const char *args[16] = { "--socket", SOCKET };
+	for (size_t i = 0; scenario->mock_args[i] != NULL; i++) {
+		args[i + 2] = scenario->mock_args[i];
+	}
+
+	int fds[2];
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return -1;
+	}
+	pid_t pid = spawn(path, args, fds[1]);
+	close(fds[1]);
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		return -1;
+	}
+
+	char line[64];
+	size_t len = 0;
+	while (len < sizeof(line) - 1) {
+		ssize_t n = read(fds[0], &line[len], sizeof(line) - 1 - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			break;
+		}
+		len += n;
+		if (memchr(line, '\n', len) != NULL) {
+			break;
+		}
+	}
+	close(fds[0]);
+	line[len] = '\0';
+	if (strncmp(line, "ready", 5) != 0) {
+		fprintf(stderr, "mock compositor failed to start\n");
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	return pid;
+}
+
+static bool stop_mock(pid_t pid) {
+	int status;
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) < 0) {
+		return false;
+	}
+	// A protocol error from wlr-randr doesn't make the mock exit, but
+	// crashes are worth knowing about
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static void print_latencies(const char *name, double latencies[static RUNS],
+		double elapsed) {
+	double total = 0;
+	for (int i = 0; i < RUNS; i++) {
+		total += latencies[i];
+	}
+	qsort(latencies, RUNS, sizeof(latencies[0]), compare_double);
+	printf("%s: mean %.3f ms, p50 %.3f ms, p99 %.3f ms, %.1f runs/s\n",
+		name, total * 1e3 / RUNS, latencies[RUNS / 2] * 1e3,
+		latencies[(RUNS * 99 - 1) / 100] * 1e3, RUNS / elapsed);
+}
+
+static bool run_scenario(const char *mock, const char *randr,
+		const struct scenario *scenario) {
+	pid_t mock_pid = start_mock(mock, scenario);
+	if (mock_pid < 0) {
+		return false;
+	}
+
+	double latencies[RUNS];
+	bool ok = true;
+	double start = now();
+	for (int i = 0; i < RUNS && ok; i++) {
+		double run_start = now();
+		pid_t pid = spawn(randr, scenario->randr_args, -1);
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+			perror("failed to run wlr-randr");
+			ok = false;
+			break;
+		}
+		latencies[i] = now() - run_start;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != scenario->exit_code) {
+			fprintf(stderr, "%s: run %d exited with status %d, expected %d\n",
+				scenario->name, i, status, scenario->exit_code);
+			ok = false;
+		}
+	}
+	double elapsed = now() - start;
+	if (!stop_mock(mock_pid)) {
+		fprintf(stderr, "%s: mock compositor didn't exit cleanly\n",
+			scenario->name);
+		ok = false;
+	}
+	if (!ok) {
+		return false;
+	}
+	print_latencies(scenario->name, latencies, elapsed);
+	return true;
+}
+
+static bool read_answer(FILE *f, const char *name, int run) {
+	char answer[64];
+	if (fgets(answer, sizeof(answer), f) == NULL) {
+		fprintf(stderr, "%s: no answer to command %d\n", name, run);
+		return false;
+	} else if (strcmp(answer, "ok\n") != 0) {
+		fprintf(stderr, "%s: command %d failed\n", name, run);
+		return false;
+	}
+	return true;
+}
+
+// Steps through modes over one --stdin-commands session
+static bool run_command_pipe(const char *mock, const char *randr) {
+	const char *name = "command pipe, apply, 4 heads";
+	const struct scenario scenario = {
+		.mock_args = { "--heads", "4", "--modes", "16" },
+	};
+	pid_t mock_pid = start_mock(mock, &scenario);
+	if (mock_pid < 0) {
+		return false;
+	}
+
+	int in[2], out[2];
+	if (pipe(in) != 0 || pipe(out) != 0) {
+		perror("pipe");
+		stop_mock(mock_pid);
+		return false;
+	}
+	// Only wlr-randr keeps its ends, so that it sees the end of its input
+	fcntl(in[1], F_SETFD, FD_CLOEXEC);
+	fcntl(out[0], F_SETFD, FD_CLOEXEC);
+	const char *const args[] = { "--stdin-commands", NULL };
+	pid_t pid = spawn_with_input(randr, args, in[0], out[1]);
+	close(in[0]);
+	close(out[1]);
+	FILE *commands = fdopen(in[1], "w");
+	FILE *answers = fdopen(out[0], "r");
+
+	double latencies[RUNS];
+	bool ok = pid >= 0 && commands != NULL && answers != NULL;
+	double start = now();
+	for (int i = 0; i < RUNS && ok; i++) {
+		double run_start = now();
+		fprintf(commands, "output HEAD-1 mode 1920x1080@%s\napply\n",
+			i % 2 == 0 ? "144" : "60");
+		fflush(commands);
+		ok = read_answer(answers, name, i) && read_answer(answers, name, i);
+		latencies[i] = now() - run_start;
+	}
+	double elapsed = now() - start;
+
+	if (commands != NULL) {
+		fprintf(commands, "quit\n");
+		fclose(commands);
+	}
+	if (answers != NULL) {
+		fclose(answers);
+	}
+	int status;
+	if (pid >= 0 && (waitpid(pid, &status, 0) < 0 ||
+			!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+		fprintf(stderr, "%s: wlr-randr didn't exit cleanly\n", name);
+		ok = false;
+	}
+	if (!stop_mock(mock_pid)) {
+		fprintf(stderr, "%s: mock compositor didn't exit cleanly\n", name);
+		ok = false;
+	}
+	if (!ok) {
+		return false;
+	}
+	print_latencies(name, latencies, elapsed);
+	return true;
+}
+
+// Returns false if the process didn't exit before the timeout, in seconds
+static bool wait_timeout(pid_t pid, int *status, double timeout) {
+	double deadline = now() + timeout;
+	while (waitpid(pid, status, WNOHANG) == 0) {
+		if (now() >= deadline) {
+			kill(pid, SIGKILL);
+			waitpid(pid, status, 0);
+			return false;
+		}
+		struct timespec delay = { .tv_nsec = 1000000 };
+		nanosleep(&delay, NULL);
+	}
+	return true;
+}
+
+/*
+ * Queries a cache kept up to date by --watch --cache. The compositor is
+ * stopped once the cache is older than the heartbeat of the writer, a query
+ * falling back to the compositor would never finish.
+ */
+static bool run_cached_query(const char *mock, const char *randr) {
+	const char *name = "cached query, 128 heads";
+	const struct scenario scenario = {
+		.mock_args = { "--heads", "128", "--modes", "300" },
+	};
+	pid_t mock_pid = start_mock(mock, &scenario);
+	if (mock_pid < 0) {
+		return false;
+	}
+
+	const char *const writer_args[] = { "--watch", "--cache", NULL };
+	pid_t writer_pid = spawn(randr, writer_args, -1);
+	struct timespec delay = { .tv_sec = 2 };
+	nanosleep(&delay, NULL);
+	kill(mock_pid, SIGSTOP);
+
+	const char *const args[] = { "--cached", NULL };
+	double latencies[RUNS];
+	bool ok = writer_pid >= 0;
+	double start = now();
+	for (int i = 0; i < RUNS && ok; i++) {
+		double run_start = now();
+		pid_t pid = spawn(randr, args, -1);
+		int status;
+		if (pid < 0 || !wait_timeout(pid, &status, 1)) {
+			fprintf(stderr, "%s: run %d wasn't answered from the cache\n",
+				name, i);
+			ok = false;
+			break;
+		}
+		latencies[i] = now() - run_start;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "%s: run %d exited with status %d\n",
+				name, i, status);
+			ok = false;
+		}
+	}
+	double elapsed = now() - start;
+
+	kill(mock_pid, SIGCONT);
+	if (writer_pid >= 0) {
+		kill(writer_pid, SIGTERM);
+		waitpid(writer_pid, NULL, 0);
+	}
+	if (!stop_mock(mock_pid)) {
+		fprintf(stderr, "%s: mock compositor didn't exit cleanly\n", name);
+		ok = false;
+	}
+	if (!ok) {
+		return false;
+	}
+	print_latencies(name, latencies, elapsed);
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: bench-e2e <mock-compositor> <wlr-randr>\n");
+		return EXIT_FAILURE;
+	}
+
+	// Keep away from the user's compositor and daemon
+	char runtime_dir[] = "/tmp/wlr-randr-bench-XXXXXX";
+	if (mkdtemp(runtime_dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+	setenv("WAYLAND_DISPLAY", SOCKET, 1);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%d runs per scenario\n", RUNS);
+	bool ok = true;
+	size_t scenarios_len = sizeof(scenarios) / sizeof(scenarios[0]);
+	for (size_t i = 0; i < scenarios_len; i++) {
+		ok = run_scenario(argv[1], argv[2], &scenarios[i]) && ok;
+	}
+	ok = run_command_pipe(argv[1], argv[2]) && ok;
+	ok = run_cached_query(argv[1], argv[2]) && ok;
+
+	rmdir(runtime_dir);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
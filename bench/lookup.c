@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "randr.h"
+
+#define HEADS 128
+#define MODES_PER_HEAD 300
+#define ROUNDS 100
+
+/*
+ * Replays the events a compositor sends for a large setup (head, name,
+ * mode, size, refresh, done), then rounds of current_mode events and option
+ * lookups touching every head, and compares plain list scans with the
+ * indices and mode tables kept by state.c and modes.c. The proxies are never dereferenced, so distinct
+ * addresses in a byte array stand in for them.
+ */
+
+static char fake_proxies[HEADS * (MODES_PER_HEAD + 1)];
+
+static struct zwlr_output_mode_v1 *fake_mode(int head, int mode) {
+	return (struct zwlr_output_mode_v1 *)
+		&fake_proxies[head * (MODES_PER_HEAD + 1) + mode + 1];
+}
+
+static struct zwlr_output_head_v1 *fake_head(int head) {
+	return (struct zwlr_output_head_v1 *)
+		&fake_proxies[head * (MODES_PER_HEAD + 1)];
+}
+
+static int32_t mode_width(int mode) {
+	return 640 + (mode / 6) * 64;
+}
+
+static int32_t mode_height(int mode) {
+	return 480 + (mode / 6) * 36;
+}
+
+static int32_t mode_refresh(int mode) {
+	return 30000 + (mode % 6) * 24000;
+}
+
+static struct randr_head *linear_find_head(struct randr_state *state,
+		const char *name) {
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (strcmp(head->name, name) == 0) {
+			return head;
+		}
+	}
+	return NULL;
+}
+
+static struct randr_mode *linear_find_mode(struct randr_head *head,
+		int32_t width, int32_t height, int32_t refresh) {
+	struct randr_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->width == width && mode->height == height &&
+				(refresh == 0 || mode->refresh == refresh)) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+static struct randr_mode *linear_find_mode_by_proxy(struct randr_head *head,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->wlr_mode == wlr_mode) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+static void enumerate(struct randr_state *state, bool indexed) {
+	*state = (struct randr_state){ .version = 4 };
+	wl_list_init(&state->heads);
+
+	for (int i = 0; i < HEADS; i++) {
+		struct randr_head *head = create_head(state, fake_head(i));
+		char name[32];
+		snprintf(name, sizeof(name), "DP-%d", i);
+		if (indexed) {
+			set_head_name(head, name);
+		} else {
+			head->name = arena_strdup(&head->arena, name);
+		}
+
+		for (int j = 0; j < MODES_PER_HEAD; j++) {
+			struct randr_mode *mode;
+			if (indexed) {
+				mode = create_mode(head, fake_mode(i, j));
+				set_mode_size(mode, mode_width(j), mode_height(j));
+			} else {
+				mode = arena_alloc(&head->arena, sizeof(*mode));
+				mode->head = head;
+				mode->wlr_mode = fake_mode(i, j);
+				mode->width = mode_width(j);
+				mode->height = mode_height(j);
+				wl_list_insert(head->modes.prev, &mode->link);
+			}
+			mode->refresh = mode_refresh(j);
+		}
+	}
+
+	// The mode tables are built on the done event
+	if (indexed) {
+		struct randr_head *head;
+		wl_list_for_each(head, &state->heads, link) {
+			sort_modes(head);
+		}
+	}
+}
+
+/*
+ * One configuration round: every head gets a current_mode event, then is
+ * resolved by name and has a mode picked, as for "--output X --mode WxH".
+ */
+static void lookup_round(struct randr_state *state, bool indexed, int round) {
+	for (int i = HEADS - 1; i >= 0; i--) {
+		char name[32];
+		snprintf(name, sizeof(name), "DP-%d", i);
+		struct randr_head *head = indexed ? find_head(state, name) :
+			linear_find_head(state, name);
+		if (head == NULL) {
+			fprintf(stderr, "unknown output %s\n", name);
+			exit(EXIT_FAILURE);
+		}
+
+		struct zwlr_output_mode_v1 *current =
+			fake_mode(i, MODES_PER_HEAD - 1 - (i + round) % 64);
+		head->mode = indexed ? find_mode_by_proxy(head, current) :
+			linear_find_mode_by_proxy(head, current);
+
+		int j = MODES_PER_HEAD - 1 - (i + round) % 96;
+		struct randr_mode *mode = indexed ?
+			find_mode(head, mode_width(j), mode_height(j), 0) :
+			linear_find_mode(head, mode_width(j), mode_height(j), 0);
+		if (mode == NULL || head->mode == NULL) {
+			fprintf(stderr, "unknown mode on %s\n", name);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void finish_state(struct randr_state *state) {
+	struct randr_head *head, *tmp_head;
+	wl_list_for_each_safe(head, tmp_head, &state->heads, link) {
+		free_head(head);
+	}
+	hash_table_finish(&state->heads_by_name);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, bool indexed) {
+	struct randr_state state;
+	double start = now();
+	enumerate(&state, indexed);
+	double enumerated = now();
+	for (int i = 0; i < ROUNDS; i++) {
+		lookup_round(&state, indexed, i);
+	}
+	double end = now();
+	finish_state(&state);
+
+	printf("%s: enumeration %.3f ms, %.3f ms per configuration round\n",
+		name, (enumerated - start) * 1e3, (end - enumerated) * 1e3 / ROUNDS);
+}
+
+int main(int argc, char *argv[]) {
+	printf("%d heads, %d modes per head, %d rounds\n",
+		HEADS, MODES_PER_HEAD, ROUNDS);
+	run("linear", false);
+	run("indexed", true);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,685 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+#include "wlr-output-management-unstable-v1-server-protocol.h"
+
+/*
+ * Minimal headless compositor which only implements the output management
+ * protocol, with synthetic heads. Configurations can be answered after a
+ * delay, and made to fail or be cancelled periodically. "ready" is printed
+ * on standard output once clients can connect.
+ */
+
+#define MANAGER_VERSION 4
+
+struct mock_mode {
+	int32_t width, height, refresh;
+	bool preferred;
+};
+
+struct mock_head {
+	char name[32], description[64], serial_number[32];
+	struct mock_mode *modes;
+	size_t modes_len;
+
+	bool enabled;
+	size_t current; // index into modes
+	int32_t x, y;
+	int32_t transform;
+	wl_fixed_t scale;
+	uint32_t adaptive_sync;
+};
+
+struct mock_server {
+	struct wl_display *display;
+	struct mock_head *heads;
+	size_t heads_len, modes_len;
+	uint32_t serial;
+	struct wl_list managers; // struct mock_manager.link
+
+	int delay; // ms
+	int fail_every, cancel_every; // 0 if disabled
+	unsigned long configurations;
+};
+
+// Resources bound by one client
+struct mock_manager {
+	struct mock_server *server;
+	struct wl_resource *resource;
+	struct wl_list link;
+	struct wl_resource **heads; // NULL once released
+	struct wl_resource **modes; // heads_len * modes_len
+};
+
+struct mock_config {
+	struct mock_server *server;
+	struct wl_resource *resource;
+	uint32_t serial;
+	struct mock_head *pending; // copy of the heads
+	bool *configured;
+	bool used, test;
+	struct wl_event_source *timer;
+};
+
+struct mock_config_head {
+	struct mock_config *config;
+	size_t index;
+};
+
+static const struct mock_mode mode_templates[] = {
+	{ 1920, 1080, 60000, false }, { 1920, 1080, 144000, false },
+	{ 2560, 1440, 60000, false }, { 2560, 1440, 165000, false },
+	{ 3840, 2160, 60000, false }, { 1280, 720, 60000, false },
+	{ 1024, 768, 75029, false }, { 800, 600, 60317, false },
+};
+
+static void forget_resource(struct mock_server *server,
+		struct wl_resource *resource) {
+	size_t modes_len = server->heads_len * server->modes_len;
+	struct mock_manager *manager;
+	wl_list_for_each(manager, &server->managers, link) {
+		for (size_t i = 0; i < server->heads_len; i++) {
+			if (manager->heads[i] == resource) {
+				manager->heads[i] = NULL;
+			}
+		}
+		for (size_t i = 0; i < modes_len; i++) {
+			if (manager->modes[i] == resource) {
+				manager->modes[i] = NULL;
+			}
+		}
+	}
+}
+
+static struct mock_server *server_from_head(struct wl_resource *resource) {
+	return wl_resource_get_user_data(resource);
+}
+
+static void handle_head_resource_destroy(struct wl_resource *resource) {
+	forget_resource(server_from_head(resource), resource);
+}
+
+static void head_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_head_v1_interface head_impl = {
+	.release = head_handle_release,
+};
+
+static void mode_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_mode_v1_interface mode_impl = {
+	.release = mode_handle_release,
+};
+
+static void send_head_state(struct mock_manager *manager, size_t index) {
+	struct mock_server *server = manager->server;
+	struct mock_head *head = &server->heads[index];
+	struct wl_resource *resource = manager->heads[index];
+	if (resource == NULL) {
+		return;
+	}
+
+	zwlr_output_head_v1_send_enabled(resource, head->enabled);
+	if (head->enabled) {
+		struct wl_resource *mode =
+			manager->modes[index * server->modes_len + head->current];
+		if (mode != NULL) {
+			zwlr_output_head_v1_send_current_mode(resource, mode);
+		}
+		zwlr_output_head_v1_send_position(resource, head->x, head->y);
+		zwlr_output_head_v1_send_transform(resource, head->transform);
+		zwlr_output_head_v1_send_scale(resource, head->scale);
+	}
+	if (wl_resource_get_version(resource) >=
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_SINCE_VERSION) {
+		zwlr_output_head_v1_send_adaptive_sync(resource, head->adaptive_sync);
+	}
+}
+
+static bool send_head(struct mock_manager *manager, size_t index) {
+	struct mock_server *server = manager->server;
+	struct mock_head *head = &server->heads[index];
+	struct wl_client *client = wl_resource_get_client(manager->resource);
+	int version = wl_resource_get_version(manager->resource);
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_output_head_v1_interface, version, 0);
+	if (resource == NULL) {
+		return false;
+	}
+	wl_resource_set_implementation(resource, &head_impl, server,
+		handle_head_resource_destroy);
+	manager->heads[index] = resource;
+
+	zwlr_output_manager_v1_send_head(manager->resource, resource);
+	zwlr_output_head_v1_send_name(resource, head->name);
+	zwlr_output_head_v1_send_description(resource, head->description);
+	zwlr_output_head_v1_send_physical_size(resource, 600, 340);
+
+	for (size_t i = 0; i < head->modes_len; i++) {
+		const struct mock_mode *mode = &head->modes[i];
+		struct wl_resource *mode_resource = wl_resource_create(client,
+			&zwlr_output_mode_v1_interface, version, 0);
+		if (mode_resource == NULL) {
+			return false;
+		}
+		wl_resource_set_implementation(mode_resource, &mode_impl, server,
+			handle_head_resource_destroy);
+		manager->modes[index * server->modes_len + i] = mode_resource;
+
+		zwlr_output_head_v1_send_mode(resource, mode_resource);
+		zwlr_output_mode_v1_send_size(mode_resource, mode->width,
+			mode->height);
+		zwlr_output_mode_v1_send_refresh(mode_resource, mode->refresh);
+		if (mode->preferred) {
+			zwlr_output_mode_v1_send_preferred(mode_resource);
+		}
+	}
+
+	if (version >= ZWLR_OUTPUT_HEAD_V1_MAKE_SINCE_VERSION) {
+		zwlr_output_head_v1_send_make(resource, "Mock");
+		zwlr_output_head_v1_send_model(resource, "Synthetic");
+		zwlr_output_head_v1_send_serial_number(resource, head->serial_number);
+	}
+	send_head_state(manager, index);
+	return true;
+}
+
+static void broadcast_state(struct mock_server *server) {
+	server->serial++;
+	struct mock_manager *manager;
+	wl_list_for_each(manager, &server->managers, link) {
+		for (size_t i = 0; i < server->heads_len; i++) {
+			send_head_state(manager, i);
+		}
+		zwlr_output_manager_v1_send_done(manager->resource, server->serial);
+	}
+}
+
+static void config_head_handle_set_mode(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *mode_resource) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	struct mock_server *server = config_head->config->server;
+	size_t index = config_head->index;
+
+	struct mock_manager *manager;
+	wl_list_for_each(manager, &server->managers, link) {
+		for (size_t i = 0; i < server->modes_len; i++) {
+			if (manager->modes[index * server->modes_len + i] ==
+					mode_resource) {
+				config_head->config->pending[index].current = i;
+				return;
+			}
+		}
+	}
+	wl_resource_post_error(resource,
+		ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_MODE,
+		"mode doesn't belong to head");
+}
+
+static void config_head_handle_set_custom_mode(struct wl_client *client,
+		struct wl_resource *resource, int32_t width, int32_t height,
+		int32_t refresh) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	struct mock_head *head = &config_head->config->pending[config_head->index];
+	for (size_t i = 0; i < head->modes_len; i++) {
+		if (head->modes[i].width == width && head->modes[i].height == height) {
+			head->current = i;
+			return;
+		}
+	}
+	wl_resource_post_error(resource,
+		ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_CUSTOM_MODE,
+		"unsupported custom mode");
+}
+
+static void config_head_handle_set_position(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	struct mock_head *head = &config_head->config->pending[config_head->index];
+	head->x = x;
+	head->y = y;
+}
+
+static void config_head_handle_set_transform(struct wl_client *client,
+		struct wl_resource *resource, int32_t transform) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (transform < 0 || transform > 7) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_TRANSFORM,
+			"invalid transform");
+		return;
+	}
+	config_head->config->pending[config_head->index].transform = transform;
+}
+
+static void config_head_handle_set_scale(struct wl_client *client,
+		struct wl_resource *resource, wl_fixed_t scale) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (scale <= 0) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_SCALE,
+			"invalid scale");
+		return;
+	}
+	config_head->config->pending[config_head->index].scale = scale;
+}
+
+static void config_head_handle_set_adaptive_sync(struct wl_client *client,
+		struct wl_resource *resource, uint32_t state) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	config_head->config->pending[config_head->index].adaptive_sync = state;
+}
+
+static const struct zwlr_output_configuration_head_v1_interface
+		config_head_impl = {
+	.set_mode = config_head_handle_set_mode,
+	.set_custom_mode = config_head_handle_set_custom_mode,
+	.set_position = config_head_handle_set_position,
+	.set_transform = config_head_handle_set_transform,
+	.set_scale = config_head_handle_set_scale,
+	.set_adaptive_sync = config_head_handle_set_adaptive_sync,
+};
+
+static void handle_config_head_resource_destroy(struct wl_resource *resource) {
+	free(wl_resource_get_user_data(resource));
+}
+
+static void destroy_config(struct mock_config *config) {
+	if (config->timer != NULL) {
+		wl_event_source_remove(config->timer);
+	}
+	free(config->pending);
+	free(config->configured);
+	free(config);
+}
+
+static void handle_config_resource_destroy(struct wl_resource *resource) {
+	destroy_config(wl_resource_get_user_data(resource));
+}
+
+static size_t head_index(struct mock_config *config,
+		struct wl_resource *head_resource) {
+	struct mock_server *server = config->server;
+	struct mock_manager *manager;
+	wl_list_for_each(manager, &server->managers, link) {
+		for (size_t i = 0; i < server->heads_len; i++) {
+			if (manager->heads[i] == head_resource) {
+				return i;
+			}
+		}
+	}
+	return server->heads_len;
+}
+
+static bool configure_head(struct mock_config *config,
+		struct wl_resource *head_resource, bool enabled) {
+	size_t index = head_index(config, head_resource);
+	if (index == config->server->heads_len) {
+		return false; // released, nothing to do
+	}
+	if (config->configured[index]) {
+		wl_resource_post_error(config->resource,
+			ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_CONFIGURED_HEAD,
+			"head configured twice");
+		return false;
+	}
+	config->configured[index] = true;
+	config->pending[index].enabled = enabled;
+	return true;
+}
+
+static void config_handle_enable_head(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *head_resource) {
+	struct mock_config *config = wl_resource_get_user_data(resource);
+	struct mock_config_head *config_head = calloc(1, sizeof(*config_head));
+	struct wl_resource *config_head_resource = wl_resource_create(client,
+		&zwlr_output_configuration_head_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (config_head == NULL || config_head_resource == NULL) {
+		free(config_head);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	config_head->config = config;
+	config_head->index = head_index(config, head_resource);
+	wl_resource_set_implementation(config_head_resource, &config_head_impl,
+		config_head, handle_config_head_resource_destroy);
+
+	if (!configure_head(config, head_resource, true)) {
+		// Keep the requests harmless
+		config_head->index = 0;
+	}
+}
+
+static void config_handle_disable_head(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *head_resource) {
+	struct mock_config *config = wl_resource_get_user_data(resource);
+	configure_head(config, head_resource, false);
+}
+
+static int respond(void *data) {
+	struct mock_config *config = data;
+	struct mock_server *server = config->server;
+	if (config->timer != NULL) {
+		wl_event_source_remove(config->timer);
+		config->timer = NULL;
+	}
+
+	server->configurations++;
+	if (config->serial != server->serial) {
+		zwlr_output_configuration_v1_send_cancelled(config->resource);
+	} else if (server->cancel_every > 0 &&
+			server->configurations % server->cancel_every == 0) {
+		// As if something else changed the outputs meanwhile
+		broadcast_state(server);
+		zwlr_output_configuration_v1_send_cancelled(config->resource);
+	} else if (server->fail_every > 0 &&
+			server->configurations % server->fail_every == 0) {
+		zwlr_output_configuration_v1_send_failed(config->resource);
+	} else {
+		zwlr_output_configuration_v1_send_succeeded(config->resource);
+		if (!config->test) {
+			memcpy(server->heads, config->pending,
+				server->heads_len * sizeof(*server->heads));
+			broadcast_state(server);
+		}
+	}
+	wl_display_flush_clients(server->display);
+	return 0;
+}
+
+static void finish_config(struct wl_resource *resource, bool test) {
+	struct mock_config *config = wl_resource_get_user_data(resource);
+	struct mock_server *server = config->server;
+	if (config->used) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_USED,
+			"configuration already used");
+		return;
+	}
+	for (size_t i = 0; i < server->heads_len; i++) {
+		if (!config->configured[i]) {
+			wl_resource_post_error(resource,
+				ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_UNCONFIGURED_HEAD,
+				"head %s not configured", server->heads[i].name);
+			return;
+		}
+	}
+	config->used = true;
+	config->test = test;
+
+	if (server->delay > 0) {
+		struct wl_event_loop *loop = wl_display_get_event_loop(server->display);
+		config->timer = wl_event_loop_add_timer(loop, respond, config);
+		if (config->timer != NULL) {
+			wl_event_source_timer_update(config->timer, server->delay);
+			return;
+		}
+	}
+	respond(config);
+}
+
+static void config_handle_apply(struct wl_client *client,
+		struct wl_resource *resource) {
+	finish_config(resource, false);
+}
+
+static void config_handle_test(struct wl_client *client,
+		struct wl_resource *resource) {
+	finish_config(resource, true);
+}
+
+static void config_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_configuration_v1_interface config_impl = {
+	.enable_head = config_handle_enable_head,
+	.disable_head = config_handle_disable_head,
+	.apply = config_handle_apply,
+	.test = config_handle_test,
+	.destroy = config_handle_destroy,
+};
+
+static void manager_handle_create_configuration(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, uint32_t serial) {
+	struct mock_manager *manager = wl_resource_get_user_data(resource);
+	struct mock_server *server = manager->server;
+
+	struct mock_config *config = calloc(1, sizeof(*config));
+	if (config == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	config->server = server;
+	config->serial = serial;
+	config->pending = calloc(server->heads_len, sizeof(*config->pending));
+	config->configured = calloc(server->heads_len,
+		sizeof(*config->configured));
+	config->resource = wl_resource_create(client,
+		&zwlr_output_configuration_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (config->pending == NULL || config->configured == NULL ||
+			config->resource == NULL) {
+		destroy_config(config);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	memcpy(config->pending, server->heads,
+		server->heads_len * sizeof(*server->heads));
+	wl_resource_set_implementation(config->resource, &config_impl, config,
+		handle_config_resource_destroy);
+}
+
+static void manager_handle_stop(struct wl_client *client,
+		struct wl_resource *resource) {
+	zwlr_output_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_manager_v1_interface manager_impl = {
+	.create_configuration = manager_handle_create_configuration,
+	.stop = manager_handle_stop,
+};
+
+static void handle_manager_resource_destroy(struct wl_resource *resource) {
+	struct mock_manager *manager = wl_resource_get_user_data(resource);
+	wl_list_remove(&manager->link);
+	free(manager->heads);
+	free(manager->modes);
+	free(manager);
+}
+
+static void bind_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct mock_server *server = data;
+
+	struct mock_manager *manager = calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	manager->server = server;
+	manager->heads = calloc(server->heads_len, sizeof(*manager->heads));
+	manager->modes = calloc(server->heads_len * server->modes_len,
+		sizeof(*manager->modes));
+	manager->resource = wl_resource_create(client,
+		&zwlr_output_manager_v1_interface, version, id);
+	if (manager->heads == NULL || manager->modes == NULL ||
+			manager->resource == NULL) {
+		free(manager->heads);
+		free(manager->modes);
+		free(manager);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(manager->resource, &manager_impl, manager,
+		handle_manager_resource_destroy);
+	wl_list_insert(&server->managers, &manager->link);
+
+	for (size_t i = 0; i < server->heads_len; i++) {
+		if (!send_head(manager, i)) {
+			wl_client_post_no_memory(client);
+			return;
+		}
+	}
+	zwlr_output_manager_v1_send_done(manager->resource, server->serial);
+}
+
+static bool create_heads(struct mock_server *server) {
+	size_t templates_len = sizeof(mode_templates) / sizeof(mode_templates[0]);
+	server->heads = calloc(server->heads_len, sizeof(*server->heads));
+	if (server->heads == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < server->heads_len; i++) {
+		struct mock_head *head = &server->heads[i];
+		snprintf(head->name, sizeof(head->name), "HEAD-%zu", i);
+		snprintf(head->description, sizeof(head->description),
+			"Mock Synthetic %zu (HEAD-%zu)", i, i);
+		snprintf(head->serial_number, sizeof(head->serial_number),
+			"MOCK%08zu", i);
+
+		head->modes_len = server->modes_len;
+		head->modes = calloc(server->modes_len, sizeof(*head->modes));
+		if (head->modes == NULL) {
+			return false;
+		}
+		// Past the templates, make up refresh rates so that modes differ
+		for (size_t j = 0; j < server->modes_len; j++) {
+			head->modes[j] = mode_templates[j % templates_len];
+			head->modes[j].refresh -= (j / templates_len) * 7;
+		}
+		head->modes[0].preferred = true;
+
+		head->enabled = true;
+		head->x = i * head->modes[0].width;
+		head->scale = wl_fixed_from_int(1);
+		head->adaptive_sync = ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED;
+	}
+	return true;
+}
+
+static int handle_signal(int sig, void *data) {
+	struct mock_server *server = data;
+	wl_display_terminate(server->display);
+	return 0;
+}
+
+static const char usage[] =
+	"usage: mock-compositor [options…]\n"
+	"--socket <name>\n"
+	"--heads <count>\n"
+	"--modes <count>\n"
+	"--delay <ms>\n"
+	"--fail-every <count>\n"
+	"--cancel-every <count>\n";
+
+static const struct option options[] = {
+	{"socket", required_argument, 0, 's'},
+	{"heads", required_argument, 0, 'H'},
+	{"modes", required_argument, 0, 'm'},
+	{"delay", required_argument, 0, 'd'},
+	{"fail-every", required_argument, 0, 'f'},
+	{"cancel-every", required_argument, 0, 'c'},
+	{0},
+};
+
+int main(int argc, char *argv[]) {
+	struct mock_server server = {
+		.heads_len = 4,
+		.modes_len = 16,
+		.serial = 1,
+	};
+	wl_list_init(&server.managers);
+	const char *socket = NULL;
+
+	int c;
+	while ((c = getopt_long(argc, argv, "", options, NULL)) >= 0) {
+		switch (c) {
+		case 's':
+			socket = optarg;
+			break;
+		case 'H':
+			server.heads_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			server.modes_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			server.delay = atoi(optarg);
+			break;
+		case 'f':
+			server.fail_every = atoi(optarg);
+			break;
+		case 'c':
+			server.cancel_every = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+	if (server.modes_len == 0) {
+		fprintf(stderr, "at least one mode is required\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!create_heads(&server)) {
+		fprintf(stderr, "failed to allocate heads\n");
+		return EXIT_FAILURE;
+	}
+
+	server.display = wl_display_create();
+	if (server.display == NULL) {
+		fprintf(stderr, "failed to create display\n");
+		return EXIT_FAILURE;
+	}
+	if (wl_global_create(server.display, &zwlr_output_manager_v1_interface,
+			MANAGER_VERSION, &server, bind_manager) == NULL) {
+		fprintf(stderr, "failed to create output manager\n");
+		return EXIT_FAILURE;
+	}
+
+	if (socket != NULL) {
+		if (wl_display_add_socket(server.display, socket) != 0) {
+			fprintf(stderr, "failed to add socket %s\n", socket);
+			return EXIT_FAILURE;
+		}
+	} else {
+		socket = wl_display_add_socket_auto(server.display);
+		if (socket == NULL) {
+			fprintf(stderr, "failed to add socket\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(server.display);
+	wl_event_loop_add_signal(loop, SIGINT, handle_signal, &server);
+	wl_event_loop_add_signal(loop, SIGTERM, handle_signal, &server);
+
+	printf("ready %s\n", socket);
+	fflush(stdout);
+	wl_display_run(server.display);
+
+	wl_display_destroy(server.display);
+	for (size_t i = 0; i < server.heads_len; i++) {
+		free(server.heads[i].modes);
+	}
+	free(server.heads);
+	return EXIT_SUCCESS;
+}
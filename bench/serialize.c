@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "randr.h"
+
+#define HEADS 64
+#define MODES_PER_HEAD 200
+#define ITERATIONS 50
+
+static const int32_t sizes[][2] = {
+	{ 7680, 4320 }, { 5120, 2880 }, { 3840, 2160 }, { 2560, 1440 },
+	{ 1920, 1200 }, { 1920, 1080 }, { 1680, 1050 }, { 1280, 720 },
+};
+
+static void build_state(struct randr_state *state) {
+	*state = (struct randr_state){ .version = 4 };
+	wl_list_init(&state->heads);
+
+	for (int i = 0; i < HEADS; i++) {
+		char name[32], description[64], serial[32];
+		snprintf(name, sizeof(name), "DP-%d", i);
+		snprintf(description, sizeof(description),
+			"Vendor \"Panel\"\t%d (DP)", i);
+		snprintf(serial, sizeof(serial), "SN%08d", i);
+
+		struct randr_head *head = calloc(1, sizeof(*head));
+		head->state = state;
+		head->name = strdup(name);
+		head->description = strdup(description);
+		head->make = strdup("Vendor");
+		head->model = strdup("Panel");
+		head->serial_number = strdup(serial);
+		head->phys_width = 600;
+		head->phys_height = 340;
+		head->enabled = i % 4 != 0;
+		head->x = i * 3840;
+		head->scale = 1.5;
+		wl_list_init(&head->modes);
+		wl_list_insert(state->heads.prev, &head->link);
+
+		for (int j = 0; j < MODES_PER_HEAD; j++) {
+			struct randr_mode *mode = calloc(1, sizeof(*mode));
+			size_t size = j % (sizeof(sizes) / sizeof(sizes[0]));
+			mode->head = head;
+			mode->width = sizes[size][0];
+			mode->height = sizes[size][1];
+			mode->refresh = 240000 - j * 997;
+			mode->preferred = j == 0;
+			wl_list_insert(head->modes.prev, &mode->link);
+			if (j == 1 && head->enabled) {
+				head->mode = mode;
+			}
+		}
+	}
+}
+
+static void finish_state(struct randr_state *state) {
+	struct randr_head *head, *tmp_head;
+	wl_list_for_each_safe(head, tmp_head, &state->heads, link) {
+		struct randr_mode *mode, *tmp_mode;
+		wl_list_for_each_safe(mode, tmp_mode, &head->modes, link) {
+			free(mode);
+		}
+		free(head->name);
+		free(head->description);
+		free(head->make);
+		free(head->model);
+		free(head->serial_number);
+		free(head);
+	}
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, struct randr_state *state,
+		const struct randr_query *query,
+		void (*print)(struct randr_state *state,
+			const struct randr_query *query, struct buffer *buf)) {
+	struct buffer buf = {0};
+	double start = now();
+	for (int i = 0; i < ITERATIONS; i++) {
+		buf.len = 0;
+		print(state, query, &buf);
+	}
+	double elapsed = now() - start;
+
+	printf("%s: %.3f ms per snapshot, %zu bytes, %.1f MB/s\n", name,
+		elapsed * 1e3 / ITERATIONS, buf.len,
+		(double)buf.len * ITERATIONS / elapsed / 1e6);
+	buffer_finish(&buf);
+}
+
+int main(int argc, char *argv[]) {
+	struct randr_state state;
+	build_state(&state);
+
+	printf("%d heads, %d modes per head, %d iterations\n",
+		HEADS, MODES_PER_HEAD, ITERATIONS);
+	run("text", &state, NULL, print_state);
+	run("json", &state, NULL, print_state_json);
+
+	// --output-filter enabled --fields name,mode
+	struct randr_query query = {
+		.fields = RANDR_FIELD_NAME | RANDR_FIELD_MODES,
+		.filter = RANDR_OUTPUT_ENABLED,
+		.current_mode_only = true,
+	};
+	run("text, projected", &state, &query, print_state);
+	run("json, projected", &state, &query, print_state_json);
+
+	finish_state(&state);
+	return EXIT_SUCCESS;
+}
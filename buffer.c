@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+void buffer_finish(struct buffer *buf) {
+	free(buf->data);
+	*buf = (struct buffer){0};
+}
+
+static bool buffer_reserve(struct buffer *buf, size_t size) {
+	if (buf->failed) {
+		return false;
+	}
+	if (buf->cap - buf->len >= size) {
+		return true;
+	}
+
+	size_t cap = buf->cap > 0 ? buf->cap : 4096;
+	while (cap - buf->len < size) {
+		cap *= 2;
+	}
+	char *data = realloc(buf->data, cap);
+	if (data == NULL) {
+		buf->failed = true;
+		return false;
+	}
+	buf->data = data;
+	buf->cap = cap;
+	return true;
+}
+
+void buffer_append(struct buffer *buf, const char *data, size_t size) {
+	if (size == 0 || !buffer_reserve(buf, size)) {
+		return;
+	}
+	memcpy(buf->data + buf->len, data, size);
+	buf->len += size;
+}
+
+void buffer_append_str(struct buffer *buf, const char *str) {
+	buffer_append(buf, str, strlen(str));
+}
+
+void buffer_append_int(struct buffer *buf, int64_t value) {
+	char digits[24];
+	size_t i = sizeof(digits);
+	uint64_t abs = value < 0 ? -(uint64_t)value : (uint64_t)value;
+	do {
+		digits[--i] = '0' + abs % 10;
+		abs /= 10;
+	} while (abs > 0);
+	if (value < 0) {
+		digits[--i] = '-';
+	}
+	buffer_append(buf, &digits[i], sizeof(digits) - i);
+}
+
+void buffer_printf(struct buffer *buf, const char *fmt, ...) {
+	if (!buffer_reserve(buf, 64)) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+	va_end(args);
+	if (n < 0) {
+		buf->failed = true;
+		return;
+	}
+
+	if ((size_t)n >= buf->cap - buf->len) {
+		if (!buffer_reserve(buf, (size_t)n + 1)) {
+			return;
+		}
+		va_start(args, fmt);
+		vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, args);
+		va_end(args);
+	}
+	buf->len += n;
+}
+
+void buffer_append_json_string(struct buffer *buf, const char *str) {
+	if (str == NULL) {
+		buffer_append_str(buf, "null");
+		return;
+	}
+
+	buffer_append(buf, "\"", 1);
+
+	// Copy runs of characters which don't need escaping in one go
+	const char *run = str, *cur = str;
+	for (; *cur != '\0'; cur++) {
+		unsigned char ch = *cur;
+		if (ch >= 0x20 && ch != '"' && ch != '\\') {
+			continue;
+		}
+
+		buffer_append(buf, run, cur - run);
+		run = cur + 1;
+
+		switch (ch) {
+		case '"':
+			buffer_append(buf, "\\\"", 2);
+			break;
+		case '\\':
+			buffer_append(buf, "\\\\", 2);
+			break;
+		case '\b':
+			buffer_append(buf, "\\b", 2);
+			break;
+		case '\f':
+			buffer_append(buf, "\\f", 2);
+			break;
+		case '\n':
+			buffer_append(buf, "\\n", 2);
+			break;
+		case '\r':
+			buffer_append(buf, "\\r", 2);
+			break;
+		case '\t':
+			buffer_append(buf, "\\t", 2);
+			break;
+		default:;
+			static const char hex[] = "0123456789abcdef";
+			char escaped[] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xF] };
+			buffer_append(buf, escaped, sizeof(escaped));
+		}
+	}
+	buffer_append(buf, run, cur - run);
+
+	buffer_append(buf, "\"", 1);
+}
+
+bool write_all(int fd, const void *data, size_t size) {
+	const char *cur = data;
+	while (size > 0) {
+		ssize_t n = write(fd, cur, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		cur += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool buffer_write(struct buffer *buf, int fd) {
+	if (buf->failed) {
+		fprintf(stderr, "failed to allocate output buffer\n");
+		return false;
+	}
+	if (!write_all(fd, buf->data, buf->len)) {
+		perror("write");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,424 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * The cache is a snapshot of the state in native byte order, only meant to
+ * be read back on the same machine:
+ *
+ *     header
+ *     for each head: cache_head, 5 strings, cache_mode * modes_len
+ *
+ * Strings are a 32-bit length including the NUL terminator (0 for a NULL
+ * string) followed by the bytes. Everything is padded to 8 bytes.
+ *
+ * The cache is written by a long-running wlr-randr started with --cache on
+ * every change, which bumps the generation in the header and removes the
+ * file when it exits. The writer holds a lock next to the cache for as long
+ * as it runs, and touches the cache at least every CACHE_HEARTBEAT_MS from
+ * its event loop. If the lock is free or the cache hasn't been touched for
+ * CACHE_MAX_AGE_MS, the writer is gone or stuck, the cache may be stale and
+ * the state has to be queried from the compositor again.
+ *
+ * Plain queries don't write the cache: the serial can only be checked
+ * against the compositor after receiving the whole state, so a cache
+ * nobody keeps up to date would never save anything.
+ */
+
+#define CACHE_MAGIC 0x43525257 // "WRRC"
+#define CACHE_FORMAT 2
+#define CACHE_HEARTBEAT_MS 1000
+#define CACHE_MAX_AGE_MS (3 * CACHE_HEARTBEAT_MS)
+#define CACHE_ALIGN 8
+#define CACHE_NULL_STRING 0
+
+struct cache_header {
+	uint32_t magic, format;
+	uint32_t size; // of the whole file
+	uint32_t serial, version;
+	uint32_t heads_len;
+	uint32_t generation; // bumped by the writer on every change
+	uint32_t padding;
+};
+
+struct cache_head {
+	int32_t phys_width, phys_height;
+	int32_t x, y;
+	int32_t transform, adaptive_sync_state;
+	uint32_t enabled, modes_len;
+	uint32_t current; // index into the modes, UINT32_MAX if none
+	uint32_t padding;
+	double scale;
+};
+
+struct cache_mode {
+	int32_t width, height, refresh;
+	uint32_t preferred;
+};
+
+struct cache_reader {
+	const char *data;
+	size_t len, pos;
+};
+
+static bool get_cache_path(char *path, size_t size) {
+	return get_runtime_path(path, size, ".cache");
+}
+
+static bool get_cache_lock_path(char *path, size_t size) {
+	return get_runtime_path(path, size, ".cache.lock");
+}
+
+static void append_padding(struct buffer *buf) {
+	static const char zeroes[CACHE_ALIGN] = {0};
+	buffer_append(buf, zeroes, (CACHE_ALIGN - buf->len % CACHE_ALIGN) %
+		CACHE_ALIGN);
+}
+
+static void append_string(struct buffer *buf, const char *str) {
+	uint32_t len = str != NULL ? strlen(str) + 1 : CACHE_NULL_STRING;
+	buffer_append(buf, (const char *)&len, sizeof(len));
+	if (str != NULL) {
+		buffer_append(buf, str, len);
+	}
+	append_padding(buf);
+}
+
+static void serialize_state(struct randr_state *state, struct buffer *buf,
+		uint32_t generation) {
+	struct cache_header header = {
+		.magic = CACHE_MAGIC,
+		.format = CACHE_FORMAT,
+		.serial = state->serial,
+		.version = state->version,
+		.heads_len = wl_list_length(&state->heads),
+		.generation = generation,
+	};
+	buffer_append(buf, (const char *)&header, sizeof(header));
+
+	// Heads may be edited for an apply in flight, only what the compositor
+	// reported is cached
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		struct cache_head cache_head = {
+			.phys_width = head->phys_width,
+			.phys_height = head->phys_height,
+			.x = head->reported.x,
+			.y = head->reported.y,
+			.transform = head->reported.transform,
+			.adaptive_sync_state = head->reported.adaptive_sync_state,
+			.enabled = head->reported.enabled,
+			.modes_len = wl_list_length(&head->modes),
+			.current = UINT32_MAX,
+			.scale = wl_fixed_to_double(head->reported.scale),
+		};
+		uint32_t i = 0;
+		struct randr_mode *mode;
+		wl_list_for_each(mode, &head->modes, link) {
+			if (head->reported.mode == mode) {
+				cache_head.current = i;
+			}
+			i++;
+		}
+		buffer_append(buf, (const char *)&cache_head, sizeof(cache_head));
+
+		append_string(buf, head->name);
+		append_string(buf, head->description);
+		append_string(buf, head->make);
+		append_string(buf, head->model);
+		append_string(buf, head->serial_number);
+
+		wl_list_for_each(mode, &head->modes, link) {
+			struct cache_mode cache_mode = {
+				.width = mode->width,
+				.height = mode->height,
+				.refresh = mode->refresh,
+				.preferred = mode->preferred,
+			};
+			buffer_append(buf, (const char *)&cache_mode, sizeof(cache_mode));
+		}
+	}
+
+	if (!buf->failed) {
+		struct cache_header *written = (struct cache_header *)buf->data;
+		written->size = buf->len;
+	}
+}
+
+// Fails if another process keeps the cache up to date
+bool start_cache(struct cache_writer *writer) {
+	*writer = (struct cache_writer){ .lock_fd = -1 };
+	char path[PATH_MAX];
+	if (!get_cache_lock_path(path, sizeof(path))) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set or too long\n");
+		return false;
+	}
+	writer->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (writer->lock_fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	if (flock(writer->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+		fprintf(stderr, "the cache is already kept up to date by another "
+			"process\n");
+		close(writer->lock_fd);
+		writer->lock_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+void finish_cache(struct cache_writer *writer) {
+	if (writer->lock_fd < 0) {
+		return;
+	}
+	// Removed before the lock is released, readers never see it unlocked
+	char path[PATH_MAX];
+	if (get_cache_path(path, sizeof(path))) {
+		unlink(path);
+	}
+	close(writer->lock_fd);
+	writer->lock_fd = -1;
+}
+
+/*
+ * Shows readers that the writer still runs. Returns the deadline of the
+ * next call.
+ */
+double touch_cache(struct cache_writer *writer) {
+	double now = timings_now();
+	if (now - writer->touched >= CACHE_HEARTBEAT_MS / 1e3) {
+		char path[PATH_MAX];
+		if (get_cache_path(path, sizeof(path))) {
+			utimensat(AT_FDCWD, path, NULL, 0);
+		}
+		writer->touched = now;
+	}
+	return writer->touched + CACHE_HEARTBEAT_MS / 1e3;
+}
+
+bool write_cache(struct cache_writer *writer, struct randr_state *state) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!get_cache_path(path, sizeof(path))) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set or too long\n");
+		return false;
+	}
+	int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		fprintf(stderr, "cache path is too long\n");
+		return false;
+	}
+
+	struct buffer buf = {0};
+	serialize_state(state, &buf, ++writer->generation);
+	if (buf.failed || buf.len > UINT32_MAX) {
+		fprintf(stderr, "failed to serialize cache\n");
+		buffer_finish(&buf);
+		return false;
+	}
+
+	// Readers must never see a partially written cache
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", tmp_path, strerror(errno));
+		buffer_finish(&buf);
+		return false;
+	}
+	bool ok = write_all(fd, buf.data, buf.len);
+	ok = close(fd) == 0 && ok;
+	buffer_finish(&buf);
+	if (!ok || rename(tmp_path, path) != 0) {
+		fprintf(stderr, "failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+		return false;
+	}
+	writer->touched = timings_now();
+	return true;
+}
+
+static const void *read_cache(struct cache_reader *reader, size_t size) {
+	if (reader->len - reader->pos < size) {
+		return NULL;
+	}
+	const void *data = reader->data + reader->pos;
+	reader->pos += size;
+	reader->pos += (CACHE_ALIGN - reader->pos % CACHE_ALIGN) % CACHE_ALIGN;
+	if (reader->pos > reader->len) {
+		reader->pos = reader->len;
+	}
+	return data;
+}
+
+static bool read_cache_string(struct cache_reader *reader,
+		struct randr_head *head, char **dst) {
+	uint32_t len;
+	if (reader->len - reader->pos < sizeof(len)) {
+		return false;
+	}
+	memcpy(&len, reader->data + reader->pos, sizeof(len));
+
+	const char *record = read_cache(reader, sizeof(len) + len);
+	if (record == NULL) {
+		return false;
+	} else if (len == CACHE_NULL_STRING) {
+		*dst = NULL;
+		return true;
+	}
+
+	const char *str = record + sizeof(len);
+	if (str[len - 1] != '\0') {
+		return false;
+	}
+	*dst = arena_strdup(&head->arena, str);
+	return *dst != NULL;
+}
+
+static bool read_cache_head(struct cache_reader *reader,
+		struct randr_state *state) {
+	const struct cache_head *cache_head =
+		read_cache(reader, sizeof(*cache_head));
+	if (cache_head == NULL || cache_head->transform < 0 ||
+			cache_head->transform >= 8) {
+		return false;
+	}
+
+	struct randr_head *head = create_head(state, NULL);
+	if (head == NULL) {
+		return false;
+	}
+	head->phys_width = cache_head->phys_width;
+	head->phys_height = cache_head->phys_height;
+	head->x = cache_head->x;
+	head->y = cache_head->y;
+	head->transform = cache_head->transform;
+	head->adaptive_sync_state = cache_head->adaptive_sync_state;
+	head->enabled = cache_head->enabled;
+	head->scale = cache_head->scale;
+
+	char *name;
+	if (!read_cache_string(reader, head, &name) ||
+			!read_cache_string(reader, head, &head->description) ||
+			!read_cache_string(reader, head, &head->make) ||
+			!read_cache_string(reader, head, &head->model) ||
+			!read_cache_string(reader, head, &head->serial_number)) {
+		return false;
+	}
+	if (name != NULL) {
+		set_head_name(head, name);
+	}
+
+	// Modes are only printed, there is no need to index them
+	for (uint32_t i = 0; i < cache_head->modes_len; i++) {
+		const struct cache_mode *cache_mode =
+			read_cache(reader, sizeof(*cache_mode));
+		struct randr_mode *mode = cache_mode != NULL ?
+			arena_alloc(&head->arena, sizeof(*mode)) : NULL;
+		if (mode == NULL) {
+			return false;
+		}
+		mode->head = head;
+		mode->width = cache_mode->width;
+		mode->height = cache_mode->height;
+		mode->refresh = cache_mode->refresh;
+		mode->preferred = cache_mode->preferred;
+		wl_list_insert(head->modes.prev, &mode->link);
+		if (cache_head->current == i) {
+			head->mode = mode;
+		}
+	}
+	return true;
+}
+
+static void finish_cached_state(struct randr_state *state) {
+	struct randr_head *head, *tmp;
+	wl_list_for_each_safe(head, tmp, &state->heads, link) {
+		free_head(head);
+	}
+	hash_table_finish(&state->heads_by_name);
+}
+
+// The lock can only be taken once the writer is gone
+static bool writer_alive(void) {
+	char path[PATH_MAX];
+	if (!get_cache_lock_path(path, sizeof(path))) {
+		return false;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool alive = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+	close(fd);
+	return alive;
+}
+
+static bool is_touched_recently(const struct stat *st) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	double age = (now.tv_sec - st->st_mtim.tv_sec) * 1000.0 +
+		(now.tv_nsec - st->st_mtim.tv_nsec) / 1000000.0;
+	return age < CACHE_MAX_AGE_MS;
+}
+
+bool print_cache(enum randr_format format, const struct randr_query *query,
+		int *exit_code) {
+	char path[PATH_MAX];
+	if (!get_cache_path(path, sizeof(path))) {
+		return false;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+			(size_t)st.st_size < sizeof(struct cache_header) ||
+			!is_touched_recently(&st) || !writer_alive()) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	struct cache_reader reader = { .data = data, .len = st.st_size };
+	const struct cache_header *header = read_cache(&reader, sizeof(*header));
+	struct randr_state state = {0};
+	wl_list_init(&state.heads);
+
+	bool ok = header->magic == CACHE_MAGIC &&
+		header->format == CACHE_FORMAT &&
+		header->size == (uint64_t)st.st_size;
+	if (ok) {
+		state.serial = header->serial;
+		state.has_serial = true;
+		state.version = header->version;
+		for (uint32_t i = 0; ok && i < header->heads_len; i++) {
+			ok = read_cache_head(&reader, &state);
+		}
+	}
+
+	if (ok) {
+		struct buffer buf = {0};
+		print_state_format(&state, format, query, &buf);
+		*exit_code = buffer_write(&buf, STDOUT_FILENO) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+		buffer_finish(&buf);
+	}
+
+	finish_cached_state(&state);
+	munmap(data, st.st_size);
+	return ok;
+}
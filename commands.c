@@ -0,0 +1,314 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * --stdin-commands reads commands from standard input, one per line, and
+ * runs them over the connection it already has, so that stepping through
+ * many layouts only connects and enumerates once. Events are dispatched in
+ * between, the state stays current: pending changes are kept aside
+ * meanwhile and put back on top of it.
+ *
+ *     output <name> <option> [<value>] [<option> [<value>]…]
+ *     test
+ *     apply
+ *     reset
+ *     query [text|json|json-compact]
+ *     quit
+ *
+ * Options are the ones of --output, without the dashes. Changes add up
+ * until they are applied, as with the library: a test keeps them, a failed
+ * apply or a reset drops them. Every command is answered with one line on
+ * standard output, "ok", "error" or "timeout", after the state for a query.
+ * Queries print what the compositor last reported, without pending changes.
+ * Empty lines and lines starting with # are skipped.
+ */
+
+#define MAX_LINE_SIZE 4096
+#define MAX_WORDS 64
+
+struct command_session {
+	struct randr_state *state;
+	struct wl_display *display;
+	const struct randr_command *cmd;
+
+	// Changes since the last apply or reset. The heads are only edited
+	// while a command runs, in between they follow the compositor.
+	struct layout_snapshot changes;
+	bool pending;
+};
+
+static void clear_changes(struct command_session *session) {
+	finish_layout_snapshot(&session->changes);
+	session->pending = false;
+}
+
+static int reset_changes(struct command_session *session) {
+	clear_changes(session);
+	return EXIT_SUCCESS;
+}
+
+// Puts the changes back on top of what the compositor last reported
+static bool restore_changes(struct command_session *session) {
+	if (session->pending &&
+			!restore_layout_snapshot(session->state, &session->changes,
+				false)) {
+		reset_heads(session->state);
+		clear_changes(session);
+		return false;
+	}
+	return true;
+}
+
+// Sets the edited heads aside, events may be dispatched before they apply
+static bool save_changes(struct command_session *session) {
+	struct randr_state *state = session->state;
+	struct layout_snapshot changes;
+	if (!take_layout_snapshot(state, &changes)) {
+		reset_heads(state);
+		return false;
+	}
+
+	// In the order of the heads
+	size_t i = 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		struct head_config *config = &changes.heads[i++];
+		config->set_enabled = head->enabled != head->reported.enabled;
+		// Enabling picks a mode
+		if (config->set_enabled && head->enabled && config->has_mode) {
+			config->changed |= RANDR_HEAD_MODE;
+		}
+	}
+
+	finish_layout_snapshot(&session->changes);
+	session->changes = changes;
+	session->pending = true;
+	reset_heads(state);
+	return true;
+}
+
+static int run_output(struct command_session *session,
+		char *words[], size_t len) {
+	if (len < 3) {
+		log_error("usage: output <name> <option> [<value>]…\n");
+		return EXIT_FAILURE;
+	}
+	struct randr_head *head = find_head(session->state, words[1]);
+	if (head == NULL) {
+		log_error("unknown output %s\n", words[1]);
+		return EXIT_FAILURE;
+	} else if (!restore_changes(session)) {
+		return EXIT_FAILURE;
+	}
+
+	// Unknown options are rejected by parse_output_arg(), a command which
+	// fails leaves the changes as they were
+	for (size_t i = 2; i < len; i++) {
+		const char *name = words[i];
+		const char *value = NULL;
+		if (output_option_takes_value(name)) {
+			if (i + 1 == len) {
+				log_error("option %s requires a value\n", name);
+				reset_heads(session->state);
+				return EXIT_FAILURE;
+			}
+			value = words[++i];
+		}
+		if (!parse_output_arg(head, name, value)) {
+			reset_heads(session->state);
+			return EXIT_FAILURE;
+		}
+	}
+	return save_changes(session) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int run_apply(struct command_session *session, bool test_only) {
+	if (!session->pending) {
+		return EXIT_SUCCESS;
+	}
+
+	// The heads are as the compositor last reported them
+	struct layout_snapshot original;
+	if (!take_layout_snapshot(session->state, &original)) {
+		return EXIT_FAILURE;
+	} else if (!restore_changes(session)) {
+		finish_layout_snapshot(&original);
+		return EXIT_FAILURE;
+	}
+
+	int exit_code = EXIT_FAILURE;
+	if (check_layout(session->state)) {
+		struct randr_command cmd = *session->cmd;
+		cmd.changed = true;
+		cmd.dry_run = test_only;
+		exit_code = run_transaction(session->state, session->display,
+			&original, &cmd);
+	}
+	finish_layout_snapshot(&original);
+	reset_heads(session->state);
+
+	// The compositor still has the previous state if the apply failed,
+	// else the new state has been received
+	if (exit_code != EXIT_SUCCESS || !test_only) {
+		clear_changes(session);
+	}
+	return exit_code;
+}
+
+// Binary output couldn't be told apart from the answer lines
+static bool is_text_format(enum randr_format format) {
+	return format == RANDR_FORMAT_TEXT || format == RANDR_FORMAT_JSON ||
+		format == RANDR_FORMAT_JSON_COMPACT;
+}
+
+static int run_query(struct command_session *session,
+		char *words[], size_t len) {
+	enum randr_format format = session->cmd->format;
+	if (len > 2) {
+		log_error("usage: query [<format>]\n");
+		return EXIT_FAILURE;
+	} else if (len == 2 && !parse_format(words[1], &format)) {
+		log_error("invalid format: %s\n", words[1]);
+		return EXIT_FAILURE;
+	} else if (!is_text_format(format)) {
+		log_error("only text and JSON formats can be queried\n");
+		return EXIT_FAILURE;
+	}
+
+	// Pending changes are set aside
+	struct buffer buf = {0};
+	print_state_format(session->state, format, &session->cmd->query, &buf);
+	bool ok = buffer_write(&buf, STDOUT_FILENO);
+	buffer_finish(&buf);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool answer(int exit_code) {
+	const char *result = "error\n";
+	if (exit_code == EXIT_SUCCESS) {
+		result = "ok\n";
+	} else if (exit_code == EXIT_TIMEOUT) {
+		result = "timeout\n";
+	}
+	if (!write_all(STDOUT_FILENO, result, strlen(result))) {
+		perror("write");
+		return false;
+	}
+	return true;
+}
+
+// Returns false once the session is over
+static bool run_line(struct command_session *session, char *line) {
+	char *words[MAX_WORDS];
+	size_t len = 0;
+	char *saveptr = NULL;
+	for (char *word = strtok_r(line, " \t\r", &saveptr); word != NULL;
+			word = strtok_r(NULL, " \t\r", &saveptr)) {
+		if (len == MAX_WORDS) {
+			log_error("too many words in command\n");
+			return answer(EXIT_FAILURE);
+		}
+		words[len++] = word;
+	}
+	if (len == 0 || words[0][0] == '#') {
+		return true;
+	}
+
+	int exit_code;
+	if (strcmp(words[0], "output") == 0) {
+		exit_code = run_output(session, words, len);
+	} else if (strcmp(words[0], "test") == 0 && len == 1) {
+		exit_code = run_apply(session, true);
+	} else if (strcmp(words[0], "apply") == 0 && len == 1) {
+		exit_code = run_apply(session, false);
+	} else if (strcmp(words[0], "reset") == 0 && len == 1) {
+		exit_code = reset_changes(session);
+	} else if (strcmp(words[0], "query") == 0) {
+		exit_code = run_query(session, words, len);
+	} else if (strcmp(words[0], "quit") == 0 && len == 1) {
+		answer(EXIT_SUCCESS);
+		return false;
+	} else {
+		log_error("invalid command: %s\n", words[0]);
+		exit_code = EXIT_FAILURE;
+	}
+	return answer(exit_code);
+}
+
+int run_commands(struct randr_state *state, struct wl_display *display,
+		const struct randr_command *cmd) {
+	struct command_session session = {
+		.state = state,
+		.display = display,
+		.cmd = cmd,
+	};
+
+	char line[MAX_LINE_SIZE];
+	size_t line_len = 0;
+	bool discard = false; // the rest of a line which was too long
+	bool running = true;
+	int exit_code = EXIT_SUCCESS;
+	while (running) {
+		struct pollfd fds[] = {
+			{0}, // display
+			{ .fd = STDIN_FILENO, .events = POLLIN },
+		};
+		if (poll_display(display, fds, 2, -1) < 0) {
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+		if (!(fds[1].revents & (POLLIN | POLLHUP))) {
+			continue;
+		}
+
+		ssize_t n = read(STDIN_FILENO, &line[line_len],
+			sizeof(line) - line_len);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		} else if (n < 0) {
+			perror("read");
+			exit_code = EXIT_FAILURE;
+			break;
+		} else if (n == 0) {
+			// The last line may not be terminated
+			if (line_len > 0 && !discard) {
+				line[line_len] = '\0';
+				run_line(&session, line);
+			}
+			break;
+		}
+
+		size_t end = line_len + n;
+		size_t start = 0;
+		for (size_t i = line_len; i < end && running; i++) {
+			if (line[i] != '\n') {
+				continue;
+			}
+			line[i] = '\0';
+			if (discard) {
+				discard = false;
+				log_error("command too long\n");
+				running = answer(EXIT_FAILURE);
+			} else {
+				running = run_line(&session, &line[start]);
+			}
+			start = i + 1;
+		}
+
+		line_len = end - start;
+		memmove(line, &line[start], line_len);
+		if (line_len == sizeof(line)) {
+			discard = true;
+			line_len = 0;
+		}
+	}
+
+	reset_changes(&session);
+	return exit_code;
+}
@@ -0,0 +1,911 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+static FILE *error_file = NULL;
+
+void set_error_file(FILE *f) {
+	error_file = f;
+}
+
+void log_error(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(error_file != NULL ? error_file : stderr, fmt, args);
+	va_end(args);
+}
+
+const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"dryrun", no_argument, 0, 0},
+	{"no-op-skip", no_argument, 0, 0},
+	{"test-then-apply", no_argument, 0, 0},
+	{"json", no_argument, 0, 0},
+	{"format", required_argument, 0, 0},
+	{"fields", required_argument, 0, 0},
+	{"output-filter", required_argument, 0, 0},
+	{"current-mode-only", no_argument, 0, 0},
+	{"output", required_argument, 0, 0},
+	{"on", no_argument, 0, 0},
+	{"off", no_argument, 0, 0},
+	{"toggle", no_argument, 0, 0},
+	{"mode", required_argument, 0, 0},
+	{"preferred", no_argument, 0, 0},
+	{"custom-mode", required_argument, 0, 0},
+	{"pos", required_argument, 0, 0},
+	{"transform", required_argument, 0, 0},
+	{"scale", required_argument, 0, 0},
+	{"adaptive-sync", required_argument, 0, 0},
+	{"power", required_argument, 0, 0},
+	{"daemon", no_argument, 0, 0},
+	{"watch", no_argument, 0, 0},
+	{"from-file", required_argument, 0, 0},
+	{"auto-arrange", required_argument, 0, 0},
+	{"cache", no_argument, 0, 0},
+	{"cached", no_argument, 0, 0},
+	{"confirm", required_argument, 0, 0},
+	{"timings", no_argument, 0, 0},
+	{"timeout", required_argument, 0, 0},
+	{"display", required_argument, 0, 0},
+	{"all-displays", no_argument, 0, 0},
+	{"save-profile", required_argument, 0, 0},
+	{"auto-profile", no_argument, 0, 0},
+	{"stdin-commands", no_argument, 0, 0},
+	{0},
+};
+
+/*
+ * Where a command can run depends on its options: some need a process and
+ * a connection of their own, only queries can be answered from the cache,
+ * and some can't be run on several displays at once.
+ */
+enum option_flag {
+	// Can't be forwarded to a daemon
+	OPTION_LOCAL = 1 << 0,
+	// Can be answered from the cache
+	OPTION_CACHED = 1 << 1,
+	// Long-running, interactive or reading standard input
+	OPTION_EXCLUSIVE = 1 << 2,
+	// Handled before connecting, see run_displays()
+	OPTION_DISPLAY = 1 << 3,
+	// Not part of the configuration, see power.c
+	OPTION_POWER = 1 << 4,
+};
+
+// Values of --output sub-options, parsed before the heads are known
+struct output_arg {
+	struct mode_query mode;
+	int32_t width, height, refresh; // custom mode
+	int32_t x, y;
+	enum wl_output_transform transform;
+	double scale;
+	enum zwlr_output_head_v1_adaptive_sync_state adaptive_sync_state;
+	enum randr_power power;
+};
+
+/*
+ * --output sub-options are handled in two steps: the syntax of the value is
+ * checked before connecting, so that mistakes don't cost an enumeration,
+ * then the value is applied to a head once the heads are known. Options a
+ * head is too old for are refused then.
+ */
+struct output_option {
+	const char *name; // sorted
+	uint32_t since_version; // of the head, 0 for any
+	uint32_t flags; // enum option_flag
+	bool (*parse)(const char *value, struct output_arg *arg); // NULL if none
+	bool (*apply)(struct randr_head *head, const struct output_arg *arg,
+		const char *value);
+};
+
+static bool parse_mode_arg(const char *value, struct output_arg *arg) {
+	return parse_mode_query(value, &arg->mode);
+}
+
+static bool parse_custom_mode_arg(const char *value, struct output_arg *arg) {
+	arg->refresh = 0;
+
+	// width + "x" + height
+	char *cur = (char *)value;
+	char *end;
+	arg->width = strtol(cur, &end, 10);
+	if (end[0] != 'x' || cur == end) {
+		log_error("invalid mode: invalid width: %s\n", value);
+		return false;
+	}
+
+	cur = end + 1;
+	arg->height = strtol(cur, &end, 10);
+	if (cur == end) {
+		log_error("invalid mode: invalid height: %s\n", value);
+		return false;
+	}
+	if (end[0] != '\0') {
+		// whitespace + "px"
+		cur = end;
+		while (cur[0] == ' ') {
+			cur++;
+		}
+		if (strncmp(cur, "px", 2) == 0) {
+			cur += 2;
+		}
+
+		if (cur[0] != '\0') {
+			// ("," or "@") + whitespace + refresh
+			if (cur[0] == ',' || cur[0] == '@') {
+				cur++;
+			} else {
+				log_error("invalid mode: expected refresh rate: %s\n",
+					value);
+				return false;
+			}
+			while (cur[0] == ' ') {
+				cur++;
+			}
+			double refresh_hz = strtod(cur, &end);
+			if ((end[0] != '\0' && strcmp(end, "Hz") != 0) ||
+					cur == end || refresh_hz <= 0) {
+				log_error("invalid mode: invalid refresh rate: %s\n",
+					value);
+				return false;
+			}
+
+			arg->refresh = round(refresh_hz * 1000); // Hz → mHz
+		}
+	}
+
+	return true;
+}
+
+static bool parse_pos_arg(const char *value, struct output_arg *arg) {
+	char *cur = (char *)value;
+	char *end;
+	arg->x = strtol(cur, &end, 10);
+	if (end[0] != ',' || cur == end) {
+		log_error("invalid position: %s\n", value);
+		return false;
+	}
+
+	cur = end + 1;
+	arg->y = strtol(cur, &end, 10);
+	if (end[0] != '\0') {
+		log_error("invalid position: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_transform_arg(const char *value, struct output_arg *arg) {
+	size_t len =
+		sizeof(output_transform_map) / sizeof(output_transform_map[0]);
+	for (size_t i = 0; i < len; ++i) {
+		if (strcmp(output_transform_map[i], value) == 0) {
+			arg->transform = i;
+			return true;
+		}
+	}
+	log_error("invalid transform: %s\n", value);
+	return false;
+}
+
+static bool parse_scale_arg(const char *value, struct output_arg *arg) {
+	char *end;
+	arg->scale = strtod(value, &end);
+	if (end[0] != '\0' || value == end) {
+		log_error("invalid scale: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_adaptive_sync_arg(const char *value,
+		struct output_arg *arg) {
+	if (strcmp(value, "enabled") == 0) {
+		arg->adaptive_sync_state =
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED;
+	} else if (strcmp(value, "disabled") == 0) {
+		arg->adaptive_sync_state =
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED;
+	} else {
+		log_error("invalid adaptive sync state: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static void fixup_disabled_head(struct randr_head *head) {
+	if (!head->mode && head->custom_mode.refresh == 0 &&
+			head->custom_mode.width == 0 &&
+			head->custom_mode.height == 0) {
+		head->mode = default_mode(head);
+	}
+}
+
+static bool parse_power_arg(const char *value, struct output_arg *arg) {
+	if (!parse_power(value, &arg->power)) {
+		log_error("invalid power mode: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool apply_on(struct randr_head *head, const struct output_arg *arg,
+		const char *value) {
+	if (!head->enabled) {
+		fixup_disabled_head(head);
+	}
+	head->enabled = true;
+	return true;
+}
+
+static bool apply_off(struct randr_head *head, const struct output_arg *arg,
+		const char *value) {
+	head->enabled = false;
+	return true;
+}
+
+static bool apply_toggle(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	if (head->enabled) {
+		head->enabled = false;
+	} else {
+		fixup_disabled_head(head);
+		head->enabled = true;
+	}
+	return true;
+}
+
+static void set_mode(struct randr_head *head, struct randr_mode *mode) {
+	head->changed |= RANDR_HEAD_MODE;
+	head->mode = mode;
+	head->custom_mode.width = 0;
+	head->custom_mode.height = 0;
+	head->custom_mode.refresh = 0;
+}
+
+static bool apply_mode(struct randr_head *head, const struct output_arg *arg,
+		const char *value) {
+	struct randr_mode *mode = select_mode(head, &arg->mode);
+	if (mode == NULL) {
+		log_error("unknown mode: %s\n", value);
+		return false;
+	}
+	set_mode(head, mode);
+	return true;
+}
+
+static bool apply_preferred(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	struct randr_mode *mode = preferred_mode(head);
+	if (mode == NULL) {
+		log_error("no preferred mode found\n");
+		return false;
+	}
+	set_mode(head, mode);
+	return true;
+}
+
+static bool apply_custom_mode(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	head->changed |= RANDR_HEAD_MODE;
+	head->mode = NULL;
+	head->custom_mode.width = arg->width;
+	head->custom_mode.height = arg->height;
+	head->custom_mode.refresh = arg->refresh;
+	return true;
+}
+
+static bool apply_pos(struct randr_head *head, const struct output_arg *arg,
+		const char *value) {
+	head->changed |= RANDR_HEAD_POSITION;
+	head->x = arg->x;
+	head->y = arg->y;
+	return true;
+}
+
+static bool apply_transform(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	head->changed |= RANDR_HEAD_TRANSFORM;
+	head->transform = arg->transform;
+	return true;
+}
+
+static bool apply_scale(struct randr_head *head, const struct output_arg *arg,
+		const char *value) {
+	head->changed |= RANDR_HEAD_SCALE;
+	head->scale = arg->scale;
+	return true;
+}
+
+static bool apply_adaptive_sync(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	head->changed |= RANDR_HEAD_ADAPTIVE_SYNC;
+	head->adaptive_sync_state = arg->adaptive_sync_state;
+	return true;
+}
+
+static bool apply_power_arg(struct randr_head *head,
+		const struct output_arg *arg, const char *value) {
+	head->power = arg->power;
+	return true;
+}
+
+static const struct output_option output_options[] = {
+	{
+		"adaptive-sync",
+		ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_SET_ADAPTIVE_SYNC_SINCE_VERSION,
+		0, parse_adaptive_sync_arg, apply_adaptive_sync,
+	},
+	{ "custom-mode", 0, 0, parse_custom_mode_arg, apply_custom_mode },
+	{ "mode", 0, 0, parse_mode_arg, apply_mode },
+	{ "off", 0, 0, NULL, apply_off },
+	{ "on", 0, 0, NULL, apply_on },
+	{ "pos", 0, 0, parse_pos_arg, apply_pos },
+	// wl_outputs are bound by the process which powers them
+	{
+		"power", 0, OPTION_LOCAL | OPTION_POWER,
+		parse_power_arg, apply_power_arg,
+	},
+	{ "preferred", 0, 0, NULL, apply_preferred },
+	{ "scale", 0, 0, parse_scale_arg, apply_scale },
+	{ "toggle", 0, 0, NULL, apply_toggle },
+	{ "transform", 0, 0, parse_transform_arg, apply_transform },
+};
+
+static int compare_output_option(const void *key, const void *elem) {
+	const struct output_option *option = elem;
+	return strcmp(key, option->name);
+}
+
+static const struct output_option *find_output_option(const char *name) {
+	return bsearch(name, output_options,
+		sizeof(output_options) / sizeof(output_options[0]),
+		sizeof(output_options[0]), compare_output_option);
+}
+
+// Checks the syntax of the value, returns the option if it is valid
+static const struct output_option *parse_output_value(const char *name,
+		const char *value, struct output_arg *arg) {
+	const struct output_option *option = find_output_option(name);
+	if (option == NULL) {
+		log_error("invalid option: %s\n", name);
+		return NULL;
+	} else if (option->parse != NULL && value == NULL) {
+		log_error("option %s requires a value\n", name);
+		return NULL;
+	} else if (option->parse != NULL && !option->parse(value, arg)) {
+		return NULL;
+	}
+	return option;
+}
+
+static bool apply_output_arg(struct randr_head *head,
+		const char *name, const char *value) {
+	struct output_arg arg = {0};
+	const struct output_option *option =
+		parse_output_value(name, value, &arg);
+	if (option == NULL) {
+		return false;
+	}
+	if (option->since_version > 0 &&
+			zwlr_output_head_v1_get_version(head->wlr_head) <
+			option->since_version) {
+		log_error("setting %s not supported by the compositor\n", name);
+		return false;
+	}
+	return option->apply(head, &arg, value);
+}
+
+// Unknown options take none, they are refused by parse_output_arg()
+bool output_option_takes_value(const char *name) {
+	const struct output_option *option = find_output_option(name);
+	return option != NULL && option->parse != NULL;
+}
+
+// Layout files and commands only carry the configuration
+bool parse_output_arg(struct randr_head *head,
+		const char *name, const char *value) {
+	const struct output_option *option = find_output_option(name);
+	if (option != NULL && (option->flags & OPTION_POWER)) {
+		log_error("%s can only be given on the command line\n", name);
+		return false;
+	}
+	return apply_output_arg(head, name, value);
+}
+
+const char usage[] =
+	"usage: wlr-randr [options…]\n"
+	"--help\n"
+	"--dryrun\n"
+	"--no-op-skip\n"
+	"--test-then-apply\n"
+	"--json\n"
+	"--format text|json|json-compact|cbor|msgpack\n"
+	"--fields <field>[,<field>…]\n"
+	"--output-filter enabled|disabled|<name>[,<name>…]\n"
+	"--current-mode-only\n"
+	"--daemon\n"
+	"--watch\n"
+	"--cache\n"
+	"--cached\n"
+	"--confirm <seconds>\n"
+	"--timings\n"
+	"--timeout <ms>[,<apply-ms>]\n"
+	"--display <name>\n"
+	"--all-displays\n"
+	"--from-file <path>|-\n"
+	"--auto-arrange left-to-right|grid\n"
+	"--save-profile <name>\n"
+	"--auto-profile\n"
+	"--stdin-commands\n"
+	"--output <name>\n"
+	"  --on\n"
+	"  --off\n"
+	"  --toggle\n"
+	"  --mode <width>x<height>[@[~]<refresh>Hz|@max]|~<refresh>Hz|max\n"
+	"  --custom-mode <width>x<height>[@<refresh>Hz]\n"
+	"  --preferred\n"
+	"  --pos <x>,<y>\n"
+	"  --transform normal|90|180|270|flipped|flipped-90|flipped-180|flipped-270\n"
+	"  --scale <factor>\n"
+	"  --adaptive-sync enabled|disabled\n"
+	"  --power on|off|toggle\n";
+
+static bool parse_timeout_ms(const char *value, char **end, int *ms) {
+	long n = strtol(value, end, 10);
+	if (*end == value || n <= 0 || n > INT_MAX) {
+		return false;
+	}
+	*ms = n;
+	return true;
+}
+
+// The first timeout is for enumeration, the second one for each apply
+bool parse_timeout(const char *value, struct randr_command *cmd) {
+	char *end;
+	if (!parse_timeout_ms(value, &end, &cmd->enumerate_timeout)) {
+		log_error("invalid timeout: %s\n", value);
+		return false;
+	}
+	cmd->apply_timeout = cmd->enumerate_timeout;
+	if (end[0] == ',' &&
+			!parse_timeout_ms(end + 1, &end, &cmd->apply_timeout)) {
+		log_error("invalid apply timeout: %s\n", value);
+		return false;
+	}
+	if (end[0] != '\0') {
+		log_error("invalid timeout: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Options which only fill in the command, the same way before and after
+ * connecting. Flags are set through their offset in the command.
+ */
+struct command_option {
+	const char *name; // sorted
+	uint32_t flags; // enum option_flag
+	size_t flag; // offset of a bool, if there is no parse function
+	bool (*parse)(const char *value, struct randr_command *cmd);
+};
+
+static bool parse_json(const char *value, struct randr_command *cmd) {
+	cmd->format = RANDR_FORMAT_JSON;
+	return true;
+}
+
+static bool parse_format_option(const char *value,
+		struct randr_command *cmd) {
+	if (!parse_format(value, &cmd->format)) {
+		log_error("invalid format: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_fields_option(const char *value,
+		struct randr_command *cmd) {
+	if (!parse_fields(value, &cmd->query)) {
+		log_error("invalid fields: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_output_filter_option(const char *value,
+		struct randr_command *cmd) {
+	if (!parse_output_filter(value, &cmd->query)) {
+		log_error("invalid output filter: %s\n", value);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_confirm(const char *value, struct randr_command *cmd) {
+	char *end;
+	long seconds = strtol(value, &end, 10);
+	if (end[0] != '\0' || value == end || seconds <= 0 ||
+			seconds > INT_MAX / 1000) {
+		log_error("invalid confirmation delay: %s\n", value);
+		return false;
+	}
+	cmd->confirm = seconds;
+	return true;
+}
+
+static bool parse_save_profile(const char *value,
+		struct randr_command *cmd) {
+	cmd->save_profile = value;
+	return true;
+}
+
+static bool parse_arrange_option(const char *value,
+		struct randr_command *cmd) {
+	return parse_arrange(value, &cmd->arrange);
+}
+
+static bool parse_display(const char *value, struct randr_command *cmd) {
+	if (!add_display(&cmd->displays, value)) {
+		log_error("failed to allocate display list\n");
+		return false;
+	}
+	return true;
+}
+
+#define FLAG(field) offsetof(struct randr_command, field), NULL
+
+/*
+ * Daemons and watchers need their own connection, confirmations and
+ * commands are read from the caller's standard input, timings are about
+ * this process, the daemon doesn't enforce timeouts and profiles are saved
+ * to the caller's home.
+ */
+static const struct command_option command_options[] = {
+	{ "all-displays", OPTION_DISPLAY, FLAG(displays.all) },
+	{ "auto-arrange", 0, 0, parse_arrange_option },
+	{ "auto-profile", 0, FLAG(auto_profile) },
+	{ "cache", 0, FLAG(cache) },
+	{ "cached", OPTION_CACHED | OPTION_EXCLUSIVE, FLAG(cached) },
+	{ "confirm", OPTION_LOCAL | OPTION_EXCLUSIVE, 0, parse_confirm },
+	{ "current-mode-only", OPTION_CACHED, FLAG(query.current_mode_only) },
+	{ "daemon", OPTION_LOCAL | OPTION_EXCLUSIVE, FLAG(daemon) },
+	{ "display", OPTION_DISPLAY, 0, parse_display },
+	{ "dryrun", 0, FLAG(dry_run) },
+	{ "fields", OPTION_CACHED, 0, parse_fields_option },
+	{ "format", OPTION_CACHED, 0, parse_format_option },
+	{ "json", OPTION_CACHED, 0, parse_json },
+	{ "no-op-skip", 0, FLAG(no_op_skip) },
+	{ "output-filter", OPTION_CACHED, 0, parse_output_filter_option },
+	{ "save-profile", OPTION_LOCAL, 0, parse_save_profile },
+	{
+		"stdin-commands", OPTION_LOCAL | OPTION_EXCLUSIVE,
+		FLAG(stdin_commands),
+	},
+	{ "test-then-apply", 0, FLAG(test_then_apply) },
+	{ "timeout", OPTION_LOCAL, 0, parse_timeout },
+	{ "timings", OPTION_LOCAL, FLAG(timings) },
+	{ "watch", OPTION_LOCAL | OPTION_EXCLUSIVE, FLAG(watch) },
+};
+
+#undef FLAG
+
+static int compare_command_option(const void *key, const void *elem) {
+	const struct command_option *option = elem;
+	return strcmp(key, option->name);
+}
+
+static const struct command_option *find_command_option(const char *name) {
+	return bsearch(name, command_options,
+		sizeof(command_options) / sizeof(command_options[0]),
+		sizeof(command_options[0]), compare_command_option);
+}
+
+/*
+ * Without a state, before connecting, only the syntax is checked: heads
+ * aren't looked up, layout files aren't read and the layout isn't checked.
+ * With one, options are applied to the heads.
+ */
+static bool parse_args(struct randr_state *state, int argc, char *argv[],
+		struct randr_command *cmd) {
+	struct randr_head *current_head = NULL;
+	bool has_output = false;
+	optind = 0;
+	while (1) {
+		int option_index = -1;
+		int c = getopt_long(argc, argv, "h", long_options, &option_index);
+		if (c < 0) {
+			break;
+		} else if (c == '?') {
+			if (!opterr) {
+				log_error("invalid option: %s\n", argv[optind - 1]);
+			}
+			return false;
+		} else if (c == 'h') {
+			cmd->help = true;
+			return true;
+		}
+
+		const char *name = long_options[option_index].name;
+		const char *value = optarg;
+		const struct command_option *option = find_command_option(name);
+		const struct output_option *output_option = NULL;
+		uint32_t flags = 0;
+		if (option != NULL) {
+			flags = option->flags;
+		} else if (strcmp(name, "from-file") == 0) {
+			// Layout files are read relative to the caller
+			flags = OPTION_LOCAL;
+			if (strcmp(value, "-") == 0) {
+				flags |= OPTION_EXCLUSIVE;
+			}
+		} else if (strcmp(name, "output") != 0) {
+			output_option = find_output_option(name);
+			flags = output_option->flags;
+		}
+		cmd->local |= (flags & OPTION_LOCAL) != 0;
+		cmd->uncached |= (flags & OPTION_CACHED) == 0;
+		if (flags & OPTION_EXCLUSIVE) {
+			cmd->exclusive = name;
+		}
+
+		if ((flags & OPTION_DISPLAY) && state != NULL) {
+			continue;
+		} else if (option != NULL && option->parse != NULL) {
+			if (!option->parse(value, cmd)) {
+				return false;
+			}
+		} else if (option != NULL) {
+			*(bool *)((char *)cmd + option->flag) = true;
+		} else if (output_option != NULL) {
+			if (!has_output) {
+				log_error("no --output specified before --%s\n", name);
+				return false;
+			}
+
+			struct output_arg arg;
+			if (state == NULL &&
+					parse_output_value(name, value, &arg) == NULL) {
+				return false;
+			} else if (state != NULL &&
+					!apply_output_arg(current_head, name, value)) {
+				return false;
+			}
+
+			if (output_option->flags & OPTION_POWER) {
+				cmd->power = true;
+			} else {
+				cmd->changed = true;
+			}
+		} else if (strcmp(name, "output") == 0) {
+			has_output = true;
+			if (state != NULL) {
+				current_head = find_head(state, value);
+				if (current_head == NULL) {
+					log_error("unknown output %s\n", value);
+					return false;
+				}
+			}
+		} else { // from-file
+			if (state == NULL) {
+				cmd->changed = true;
+			} else if (!parse_layout_file(state, value, &cmd->changed)) {
+				return false;
+			}
+		}
+	}
+	// Operands aren't options of any kind
+	cmd->uncached |= optind < argc;
+
+	if (cmd->cache && !cmd->daemon && !cmd->watch) {
+		log_error("--cache requires --daemon or --watch\n");
+		return false;
+	}
+	if (cmd->auto_profile && !cmd->daemon && !cmd->watch) {
+		log_error("--auto-profile requires --daemon or --watch\n");
+		return false;
+	}
+	if (cmd->watch && (cmd->query.fields != 0 ||
+			cmd->query.filter != RANDR_OUTPUT_ALL ||
+			cmd->query.current_mode_only)) {
+		log_error("--watch only reports changes, it can't be combined with "
+			"--fields, --output-filter or --current-mode-only\n");
+		return false;
+	}
+	if (cmd->cached && (cmd->changed || cmd->power || cmd->dry_run ||
+			cmd->daemon || cmd->watch || cmd->confirm ||
+			cmd->arrange != RANDR_ARRANGE_NONE)) {
+		log_error("--cached can only be combined with --json, --format and "
+			"query options\n");
+		return false;
+	}
+	if (cmd->power && cmd->dry_run) {
+		log_error("--power cannot be tested with --dryrun\n");
+		return false;
+	}
+	if (cmd->test_then_apply && cmd->dry_run) {
+		log_error("--test-then-apply cannot be combined with --dryrun\n");
+		return false;
+	}
+	if (cmd->stdin_commands && (cmd->changed || cmd->power ||
+			cmd->dry_run || cmd->daemon || cmd->watch || cmd->cached ||
+			cmd->confirm || cmd->save_profile != NULL ||
+			cmd->arrange != RANDR_ARRANGE_NONE)) {
+		log_error("--stdin-commands reads changes from standard input, it "
+			"can't be combined with other changes, --dryrun, --daemon, "
+			"--watch, --cached, --confirm or --save-profile\n");
+		return false;
+	}
+	if (cmd->stdin_commands && (cmd->format == RANDR_FORMAT_CBOR ||
+			cmd->format == RANDR_FORMAT_MSGPACK)) {
+		log_error("--stdin-commands answers in lines, it can't be "
+			"combined with binary formats\n");
+		return false;
+	}
+	if (cmd->confirm && (cmd->dry_run || (!cmd->changed &&
+			cmd->arrange == RANDR_ARRANGE_NONE))) {
+		log_error("--confirm requires changes to apply\n");
+		return false;
+	}
+
+	if (state == NULL) {
+		return true;
+	}
+
+	// Positions depend on the final modes, scales and transforms
+	if (cmd->arrange != RANDR_ARRANGE_NONE) {
+		auto_arrange(state, cmd->arrange);
+		cmd->changed = true;
+	}
+
+	// Catch mistakes before anything is sent to the compositor
+	if (cmd->changed && !check_layout(state)) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Catches mistakes in the command line before connecting, and tells where
+ * the command can run. Displays are collected, see collect_displays().
+ */
+bool check_command(int argc, char *argv[], struct randr_command *cmd) {
+	if (!parse_args(NULL, argc, argv, cmd)) {
+		finish_displays(&cmd->displays);
+		return false;
+	}
+	return true;
+}
+
+bool parse_command(struct randr_state *state, int argc, char *argv[],
+		struct randr_command *cmd) {
+	return parse_args(state, argc, argv, cmd);
+}
+
+static bool mode_is_reported(const struct randr_head *head) {
+	const struct randr_mode *reported = head->reported.mode;
+	if (head->mode != NULL || reported == NULL) {
+		return head->mode == reported;
+	}
+	// A custom mode matching an advertised one, at any rate if 0
+	return head->custom_mode.width == reported->width &&
+		head->custom_mode.height == reported->height &&
+		(head->custom_mode.refresh == 0 ||
+		head->custom_mode.refresh == reported->refresh);
+}
+
+// Changed properties which differ from what the compositor last sent
+uint32_t head_diff(const struct randr_head *head) {
+	if (!head->reported.enabled) {
+		// Nothing to compare with
+		return head->changed;
+	}
+
+	uint32_t diff = 0;
+	if ((head->changed & RANDR_HEAD_MODE) && !mode_is_reported(head)) {
+		diff |= RANDR_HEAD_MODE;
+	}
+	if ((head->changed & RANDR_HEAD_POSITION) &&
+			(head->x != head->reported.x || head->y != head->reported.y)) {
+		diff |= RANDR_HEAD_POSITION;
+	}
+	if ((head->changed & RANDR_HEAD_TRANSFORM) &&
+			head->transform != head->reported.transform) {
+		diff |= RANDR_HEAD_TRANSFORM;
+	}
+	// Compared as sent, the compositor may not have the exact value
+	if ((head->changed & RANDR_HEAD_SCALE) &&
+			wl_fixed_from_double(head->scale) != head->reported.scale) {
+		diff |= RANDR_HEAD_SCALE;
+	}
+	if ((head->changed & RANDR_HEAD_ADAPTIVE_SYNC) &&
+			head->adaptive_sync_state != head->reported.adaptive_sync_state) {
+		diff |= RANDR_HEAD_ADAPTIVE_SYNC;
+	}
+	return diff;
+}
+
+// Whether applying the state would change anything
+bool layout_differs(struct randr_state *state) {
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (head->enabled != head->reported.enabled ||
+				(head->enabled && head_diff(head) != 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Every head has to be enabled or disabled, but properties are only set if
+ * they change, so that the compositor doesn't consider the others
+ * reconfigured.
+ */
+struct zwlr_output_configuration_v1 *apply_state(struct randr_state *state,
+		bool dry_run,
+		const struct zwlr_output_configuration_v1_listener *listener,
+		void *data) {
+	struct zwlr_output_configuration_v1 *config =
+		zwlr_output_manager_v1_create_configuration(state->output_manager,
+		state->serial);
+	zwlr_output_configuration_v1_add_listener(config, listener, data);
+
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!head->enabled) {
+			zwlr_output_configuration_v1_disable_head(config, head->wlr_head);
+			continue;
+		}
+
+		struct zwlr_output_configuration_head_v1 *config_head =
+			zwlr_output_configuration_v1_enable_head(config, head->wlr_head);
+		uint32_t diff = head_diff(head);
+		if (diff & RANDR_HEAD_MODE) {
+			if (head->mode != NULL) {
+				zwlr_output_configuration_head_v1_set_mode(config_head,
+					head->mode->wlr_mode);
+			} else {
+				zwlr_output_configuration_head_v1_set_custom_mode(config_head,
+					head->custom_mode.width, head->custom_mode.height,
+					head->custom_mode.refresh);
+			}
+		}
+		if (diff & RANDR_HEAD_POSITION) {
+			zwlr_output_configuration_head_v1_set_position(config_head,
+				head->x, head->y);
+		}
+		if (diff & RANDR_HEAD_TRANSFORM) {
+			zwlr_output_configuration_head_v1_set_transform(config_head,
+				head->transform);
+		}
+		if (diff & RANDR_HEAD_SCALE) {
+			zwlr_output_configuration_head_v1_set_scale(config_head,
+				wl_fixed_from_double(head->scale));
+		}
+		if (diff & RANDR_HEAD_ADAPTIVE_SYNC) {
+			assert(zwlr_output_manager_v1_get_version(state->output_manager) >=
+				ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_SET_ADAPTIVE_SYNC_SINCE_VERSION);
+			zwlr_output_configuration_head_v1_set_adaptive_sync(config_head,
+				head->adaptive_sync_state);
+		}
+		zwlr_output_configuration_head_v1_destroy(config_head);
+	}
+
+	if (dry_run) {
+		zwlr_output_configuration_v1_test(config);
+	} else {
+		zwlr_output_configuration_v1_apply(config);
+	}
+	return config;
+}
+
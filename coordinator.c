@@ -0,0 +1,708 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * Processes applying at the same time would build their configurations on
+ * the same serial, and all but one would be cancelled. A process which gets
+ * the lock right away while nothing is queued applies on its own. Otherwise
+ * it queues its request in the runtime directory of the compositor, then
+ * waits for the lock. Whoever holds the lock serves the queue,
+ * oldest first: requests which touch disjoint heads are merged into one
+ * configuration, the others wait for the next round. Each request gets its
+ * own result file, a merged configuration which fails is applied again one
+ * request at a time so that failures are reported to the right callers.
+ *
+ * Requests are text files named after the time they were made and the
+ * process which made them:
+ *
+ *     test <0|1>
+ *     head <changed> <enabled> <set_enabled> <has_mode> <custom> <width> \
+ *         <height> <refresh> <x> <y> <transform> <scale> <adaptive_sync> \
+ *         <name>
+ *
+ * with one head line per head the request changes. Results hold the exit
+ * code. Each requester holds a lock on an owner file named like its
+ * request until it is done: requests and results whose owner file can be
+ * locked by someone else are dropped, process IDs may have been reused.
+ *
+ * Whoever serves a request first claims it by removing it from the queue,
+ * a process which gives up waiting withdraws its request the same way, so
+ * only one of them succeeds. A process which gives up after its request
+ * was claimed leaves an abandoned file behind, its result is removed with
+ * it by the next process serving the queue.
+ */
+
+#define MAX_QUEUED 64
+// Wakes up a lock wait which missed the alarm at the deadline
+#define LOCK_ALARM_INTERVAL_US 10000
+
+struct queued_request {
+	char name[64]; // without the .req suffix
+	bool test;
+	struct layout_snapshot heads;
+	bool selected;
+};
+
+struct request_queue {
+	char dir[PATH_MAX];
+	struct queued_request requests[MAX_QUEUED];
+	size_t len;
+};
+
+static bool get_queue_dir(char *path, size_t size) {
+	return get_runtime_path(path, size, "-queue");
+}
+
+static bool get_queue_path(const struct request_queue *queue,
+		const char *name, const char *suffix, char *path, size_t size) {
+	int n = snprintf(path, size, "%s/%s%s", queue->dir, name, suffix);
+	return n > 0 && (size_t)n < size;
+}
+
+static bool touches_head(const struct head_config *config) {
+	return config->changed != 0 || config->set_enabled;
+}
+
+static bool write_request(const struct request_queue *queue,
+		const char *name, const struct layout_snapshot *target, bool test) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!get_queue_path(queue, name, ".req", path, sizeof(path)) ||
+			!get_queue_path(queue, name, ".tmp", tmp_path,
+				sizeof(tmp_path))) {
+		return false;
+	}
+
+	// Whoever serves the queue never sees a partial request
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		return false;
+	}
+	fprintf(f, "test %d\n", test);
+	for (size_t i = 0; i < target->len; i++) {
+		const struct head_config *config = &target->heads[i];
+		if (config->name == NULL || !touches_head(config)) {
+			continue;
+		}
+		fprintf(f, "head %" PRIu32 " %d %d %d %d %d %d %d %d %d %d %.17g %d "
+			"%s\n", config->changed, config->enabled, config->set_enabled,
+			config->has_mode, config->custom, config->width,
+			config->height, config->refresh, config->x, config->y,
+			config->transform, config->scale, config->adaptive_sync_state,
+			config->name);
+	}
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_head_line(const char *line, struct head_config *config) {
+	int enabled, set_enabled, has_mode, custom, transform, adaptive_sync;
+	int name_start = -1;
+	sscanf(line, "head %" SCNu32 " %d %d %d %d %" SCNd32 " %" SCNd32 " %"
+		SCNd32 " %" SCNd32 " %" SCNd32 " %d %lf %d %n", &config->changed,
+		&enabled, &set_enabled, &has_mode, &custom, &config->width,
+		&config->height, &config->refresh, &config->x, &config->y,
+		&transform, &config->scale, &adaptive_sync, &name_start);
+	if (name_start < 0 || line[name_start] == '\0') {
+		return false;
+	}
+	config->enabled = enabled;
+	config->set_enabled = set_enabled;
+	config->has_mode = has_mode;
+	config->custom = custom;
+	config->transform = transform;
+	config->adaptive_sync_state = adaptive_sync;
+	config->name = strndup(&line[name_start],
+		strcspn(&line[name_start], "\n"));
+	return config->name != NULL;
+}
+
+static bool read_request(const struct request_queue *queue,
+		struct queued_request *request) {
+	char path[PATH_MAX];
+	if (!get_queue_path(queue, request->name, ".req", path, sizeof(path))) {
+		return false;
+	}
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+
+	struct layout_snapshot *heads = &request->heads;
+	char *line = NULL;
+	size_t size = 0;
+	int test = 0;
+	bool ok = getline(&line, &size, f) > 0 &&
+		sscanf(line, "test %d", &test) == 1;
+	request->test = test;
+	while (ok && getline(&line, &size, f) > 0) {
+		if (heads->len % 8 == 0) {
+			struct head_config *configs = realloc(heads->heads,
+				(heads->len + 8) * sizeof(*configs));
+			if (configs == NULL) {
+				ok = false;
+				break;
+			}
+			heads->heads = configs;
+		}
+		struct head_config *config = &heads->heads[heads->len];
+		*config = (struct head_config){0};
+		ok = parse_head_line(line, config);
+		if (ok) {
+			heads->len++;
+		}
+	}
+	free(line);
+	fclose(f);
+	return ok;
+}
+
+static void remove_request(const struct request_queue *queue,
+		const char *name) {
+	char path[PATH_MAX];
+	if (get_queue_path(queue, name, ".req", path, sizeof(path))) {
+		unlink(path);
+	}
+}
+
+// Returns false if the request was already claimed or withdrawn
+static bool claim_request(const struct request_queue *queue,
+		const char *name) {
+	char path[PATH_MAX];
+	return get_queue_path(queue, name, ".req", path, sizeof(path)) &&
+		unlink(path) == 0;
+}
+
+static void remove_result(const struct request_queue *queue,
+		const char *name) {
+	char path[PATH_MAX];
+	if (get_queue_path(queue, name, ".res", path, sizeof(path))) {
+		unlink(path);
+	}
+	if (get_queue_path(queue, name, ".abandoned", path, sizeof(path))) {
+		unlink(path);
+	}
+}
+
+static bool has_suffix(const char *name, size_t len, const char *suffix) {
+	size_t suffix_len = strlen(suffix);
+	return len > suffix_len &&
+		strcmp(&name[len - suffix_len], suffix) == 0;
+}
+
+/*
+ * The owner file is locked before it is given its name, so that it is never
+ * seen unlocked while its owner is around. Returns -1 on failure.
+ */
+static int create_owner(const struct request_queue *queue,
+		const char *name) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!get_queue_path(queue, name, ".owner", path, sizeof(path)) ||
+			!get_queue_path(queue, name, ".new", tmp_path,
+				sizeof(tmp_path))) {
+		return -1;
+	}
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0 || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void remove_owner(const struct request_queue *queue,
+		const char *name, int fd) {
+	char path[PATH_MAX];
+	if (fd < 0) {
+		return;
+	}
+	if (get_queue_path(queue, name, ".owner", path, sizeof(path))) {
+		unlink(path);
+	}
+	close(fd);
+}
+
+// The lock of the owner file is released with its last descriptor
+static bool is_owner_gone(const struct request_queue *queue,
+		const char *name) {
+	char path[PATH_MAX];
+	if (!get_queue_path(queue, name, ".owner", path, sizeof(path))) {
+		return true;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return true;
+	}
+	bool gone = flock(fd, LOCK_SH | LOCK_NB) == 0;
+	if (gone) {
+		unlink(path);
+	}
+	close(fd);
+	return gone;
+}
+
+/*
+ * Nobody reads the results of abandoned requests or of processes which are
+ * gone, nor waits on their owner files. With the lock held, no result is
+ * being written.
+ */
+static void sweep_result(const struct request_queue *queue,
+		const char *file_name, size_t len) {
+	char name[64];
+	const char *suffix = ".abandoned";
+	if (has_suffix(file_name, len, ".res")) {
+		suffix = ".res";
+	} else if (has_suffix(file_name, len, ".owner")) {
+		suffix = ".owner";
+	}
+	size_t name_len = len - strlen(suffix);
+	if (name_len >= sizeof(name)) {
+		return;
+	}
+	memcpy(name, file_name, name_len);
+	name[name_len] = '\0';
+	if (strcmp(suffix, ".abandoned") == 0) {
+		remove_result(queue, name);
+	} else if (is_owner_gone(queue, name) &&
+			strcmp(suffix, ".res") == 0) {
+		remove_result(queue, name);
+	}
+}
+
+static int compare_requests(const void *a, const void *b) {
+	const struct queued_request *request_a = a, *request_b = b;
+	return strcmp(request_a->name, request_b->name);
+}
+
+static void finish_queue(struct request_queue *queue) {
+	for (size_t i = 0; i < queue->len; i++) {
+		finish_layout_snapshot(&queue->requests[i].heads);
+	}
+	queue->len = 0;
+}
+
+// Loads the oldest requests, dropping the ones nobody waits for anymore
+static bool load_queue(struct request_queue *queue) {
+	DIR *dir = opendir(queue->dir);
+	if (dir == NULL) {
+		return false;
+	}
+
+	// Names sort by age, keep the oldest ones
+	struct queued_request *requests = queue->requests;
+	queue->len = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		struct queued_request request = {0};
+		if (has_suffix(entry->d_name, len, ".res") ||
+				has_suffix(entry->d_name, len, ".abandoned") ||
+				has_suffix(entry->d_name, len, ".owner")) {
+			sweep_result(queue, entry->d_name, len);
+			continue;
+		} else if (!has_suffix(entry->d_name, len, ".req") ||
+				len - 4 >= sizeof(request.name)) {
+			continue;
+		}
+		memcpy(request.name, entry->d_name, len - 4);
+		if (is_owner_gone(queue, request.name)) {
+			remove_request(queue, request.name);
+			continue;
+		}
+
+		if (queue->len == MAX_QUEUED) {
+			qsort(requests, queue->len, sizeof(*requests),
+				compare_requests);
+			if (strcmp(request.name, requests[queue->len - 1].name) > 0) {
+				continue;
+			}
+			queue->len--;
+		}
+		requests[queue->len++] = request;
+	}
+	closedir(dir);
+	qsort(requests, queue->len, sizeof(*requests), compare_requests);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < queue->len; i++) {
+		if (read_request(queue, &requests[i])) {
+			requests[kept++] = requests[i];
+		} else {
+			// Gone in the meantime, or unreadable
+			finish_layout_snapshot(&requests[i].heads);
+			remove_request(queue, requests[i].name);
+		}
+	}
+	queue->len = kept;
+	return true;
+}
+
+static bool shares_head(const struct layout_snapshot *a,
+		const struct layout_snapshot *b) {
+	for (size_t i = 0; i < a->len; i++) {
+		for (size_t j = 0; j < b->len; j++) {
+			if (strcmp(a->heads[i].name, b->heads[j].name) == 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * The oldest request is always selected, a later one only if it shares no
+ * head with an earlier one, selected or not, so that requests touching the
+ * same head are applied in order.
+ */
+static void select_batch(struct request_queue *queue) {
+	for (size_t i = 0; i < queue->len; i++) {
+		struct queued_request *request = &queue->requests[i];
+		request->selected = true;
+		for (size_t j = 0; j < i && request->selected; j++) {
+			request->selected =
+				!shares_head(&request->heads, &queue->requests[j].heads);
+		}
+	}
+}
+
+static int apply_requests(struct randr_state *state,
+		struct wl_display *display, struct queued_request **requests,
+		size_t len, double deadline, struct randr_timings *timings) {
+	size_t heads_len = 0;
+	bool test_first = false;
+	for (size_t i = 0; i < len; i++) {
+		heads_len += requests[i]->heads.len;
+		test_first = test_first || requests[i]->test;
+	}
+
+	// Borrows the head configurations of the requests
+	struct layout_snapshot merged = {
+		.heads = calloc(heads_len + 1, sizeof(*merged.heads)),
+	};
+	if (merged.heads == NULL) {
+		fprintf(stderr, "failed to allocate configuration\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < len; i++) {
+		memcpy(&merged.heads[merged.len], requests[i]->heads.heads,
+			requests[i]->heads.len * sizeof(*merged.heads));
+		merged.len += requests[i]->heads.len;
+	}
+
+	reset_heads(state);
+	int exit_code = apply_snapshot(state, display, &merged, false,
+		test_first, false, deadline, timings);
+	reset_heads(state);
+	free(merged.heads);
+	return exit_code;
+}
+
+static void write_result(const struct request_queue *queue,
+		const char *name, int exit_code) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!get_queue_path(queue, name, ".res", path, sizeof(path)) ||
+			!get_queue_path(queue, name, ".tmp", tmp_path,
+				sizeof(tmp_path))) {
+		return;
+	}
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		return;
+	}
+	fprintf(f, "%d\n", exit_code);
+	bool ok = !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+	}
+}
+
+// Returns false if there is no result yet
+static bool read_result(const struct request_queue *queue,
+		const char *name, int *exit_code) {
+	char path[PATH_MAX];
+	if (!get_queue_path(queue, name, ".res", path, sizeof(path))) {
+		return false;
+	}
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	if (fscanf(f, "%d", exit_code) != 1) {
+		*exit_code = EXIT_FAILURE;
+	}
+	fclose(f);
+	unlink(path);
+	return true;
+}
+
+// Applies the next batch of the queue, returns false if it is empty
+static bool serve_queue(struct request_queue *queue,
+		struct randr_state *state, struct wl_display *display,
+		const char *own_name, int *own_exit_code, bool *own_served,
+		double deadline, struct randr_timings *timings) {
+	if (!load_queue(queue) || queue->len == 0) {
+		return false;
+	}
+	select_batch(queue);
+	struct queued_request *batch[MAX_QUEUED];
+	size_t len = 0;
+	for (size_t i = 0; i < queue->len; i++) {
+		// Withdrawn requests aren't applied
+		if (queue->requests[i].selected &&
+				claim_request(queue, queue->requests[i].name)) {
+			batch[len++] = &queue->requests[i];
+		}
+	}
+	if (len == 0) {
+		finish_queue(queue);
+		return true;
+	}
+
+	int exit_codes[MAX_QUEUED];
+	int exit_code = apply_requests(state, display, batch, len, deadline,
+		timings);
+	for (size_t i = 0; i < len; i++) {
+		exit_codes[i] = exit_code;
+	}
+	// Find out which ones the compositor didn't like
+	if (exit_code == EXIT_FAILURE && len > 1) {
+		for (size_t i = 0; i < len; i++) {
+			exit_codes[i] = apply_requests(state, display, &batch[i], 1,
+				deadline, timings);
+		}
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		if (strcmp(batch[i]->name, own_name) == 0) {
+			*own_exit_code = exit_codes[i];
+			*own_served = true;
+		} else {
+			write_result(queue, batch[i]->name, exit_codes[i]);
+		}
+	}
+	finish_queue(queue);
+	return true;
+}
+
+static void handle_alarm(int sig) {
+	// Only there to interrupt flock()
+}
+
+/*
+ * Blocks in flock() until the lock is released, an alarm interrupts it at
+ * the deadline. Returns false if the deadline passed.
+ */
+static bool lock_queue(int fd, double deadline) {
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+		return true;
+	} else if (errno != EWOULDBLOCK) {
+		// Locks aren't supported, go ahead anyway
+		return true;
+	}
+
+	struct sigaction action = { .sa_handler = handle_alarm }, old_action;
+	sigemptyset(&action.sa_mask);
+	if (deadline >= 0) {
+		sigaction(SIGALRM, &action, &old_action);
+	}
+
+	bool locked = false;
+	while (deadline < 0 || timings_now() < deadline) {
+		if (deadline >= 0) {
+			int64_t us = (deadline - timings_now()) * 1e6 + 1;
+			struct itimerval timer = {
+				.it_value = { .tv_sec = us / 1000000, .tv_usec = us % 1000000 },
+				.it_interval = { .tv_usec = LOCK_ALARM_INTERVAL_US },
+			};
+			setitimer(ITIMER_REAL, &timer, NULL);
+		}
+		// Locked, or locks aren't supported
+		if (flock(fd, LOCK_EX) == 0 || errno != EINTR) {
+			locked = true;
+			break;
+		}
+	}
+
+	if (deadline >= 0) {
+		struct itimerval disarmed = {0};
+		setitimer(ITIMER_REAL, &disarmed, NULL);
+		sigaction(SIGALRM, &old_action, NULL);
+	}
+	return locked;
+}
+
+static int open_lock_file(void) {
+	char path[PATH_MAX];
+	if (!get_runtime_path(path, sizeof(path), ".lock")) {
+		return -1;
+	}
+	return open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+}
+
+/*
+ * Returns an exit code, EXIT_TIMEOUT if the deadline passed. The lock is
+ * optional: fd is set to -1 if it can't be taken.
+ */
+int open_apply_lock(double deadline, int *fd) {
+	*fd = -1;
+	int lock_fd = open_lock_file();
+	if (lock_fd < 0) {
+		return EXIT_SUCCESS;
+	}
+	if (!lock_queue(lock_fd, deadline)) {
+		close(lock_fd);
+		return EXIT_TIMEOUT;
+	}
+	*fd = lock_fd;
+	return EXIT_SUCCESS;
+}
+
+void close_apply_lock(int fd) {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+/*
+ * Called when the lock couldn't be taken in time. Whoever holds it may be
+ * applying the request already, it can only be withdrawn if it wasn't
+ * claimed.
+ */
+static int give_up_request(const struct request_queue *queue,
+		const char *name, bool *by_other) {
+	int exit_code;
+	if (claim_request(queue, name)) {
+		log_error("timed out waiting for other applies\n");
+		return EXIT_TIMEOUT;
+	} else if (read_result(queue, name, &exit_code)) {
+		*by_other = true;
+		return exit_code;
+	}
+
+	char path[PATH_MAX];
+	if (get_queue_path(queue, name, ".abandoned", path, sizeof(path))) {
+		int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	// The result may have been written in the meantime
+	if (read_result(queue, name, &exit_code)) {
+		remove_result(queue, name);
+		*by_other = true;
+		return exit_code;
+	}
+	log_error("timed out waiting for other applies, the layout may "
+		"still be applied\n");
+	return EXIT_TIMEOUT;
+}
+
+// Serves the queue until the request is applied, with the lock held
+static int wait_for_request(struct request_queue *queue,
+		struct randr_state *state, struct wl_display *display,
+		const char *name, bool *by_other, double deadline,
+		struct randr_timings *timings) {
+	// Whatever was applied before we got the lock has to be known
+	int exit_code = dispatch_exit_code(roundtrip_until(display, deadline));
+	*by_other = exit_code == EXIT_SUCCESS &&
+		read_result(queue, name, &exit_code);
+	bool served = exit_code != EXIT_SUCCESS || *by_other;
+	while (!served) {
+		if (deadline >= 0 && timings_now() >= deadline) {
+			// Leave the rest to the next process
+			log_error("timed out waiting for other applies\n");
+			exit_code = EXIT_TIMEOUT;
+			break;
+		} else if (!serve_queue(queue, state, display, name, &exit_code,
+				&served, deadline, timings)) {
+			log_error("apply request lost\n");
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+	}
+	// Nobody else can claim it while the lock is held
+	remove_request(queue, name);
+	return exit_code;
+}
+
+static bool has_requests(const struct request_queue *queue) {
+	DIR *dir = opendir(queue->dir);
+	if (dir == NULL) {
+		return false;
+	}
+	bool found = false;
+	struct dirent *entry;
+	while (!found && (entry = readdir(dir)) != NULL) {
+		found = has_suffix(entry->d_name, strlen(entry->d_name), ".req");
+	}
+	closedir(dir);
+	return found;
+}
+
+/*
+ * Queues the target layout and waits for it to be applied, by this process
+ * or another one. Returns an exit code, EXIT_TIMEOUT if the deadline passed.
+ */
+int coordinate_apply(struct randr_state *state, struct wl_display *display,
+		const struct layout_snapshot *target, bool test_first,
+		double deadline, struct randr_timings *timings) {
+	struct request_queue queue = {0};
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	char name[64];
+	snprintf(name, sizeof(name), "%020" PRIu64 "-%d",
+		(uint64_t)now.tv_sec * 1000000000 + now.tv_nsec, (int)getpid());
+
+	int exit_code;
+	int lock_fd = open_lock_file(), owner_fd = -1;
+	bool locked = lock_fd >= 0 && flock(lock_fd, LOCK_EX | LOCK_NB) == 0;
+	bool by_other = false;
+	if (!get_queue_dir(queue.dir, sizeof(queue.dir)) ||
+			(mkdir(queue.dir, 0700) != 0 && errno != EEXIST) ||
+			(locked && !has_requests(&queue)) ||
+			(owner_fd = create_owner(&queue, name)) < 0 ||
+			!write_request(&queue, name, target, test_first)) {
+		// Nobody to wait for or nowhere to queue, apply alone. A layout
+		// applied right before is caught as a cancellation.
+		exit_code = apply_snapshot(state, display, target, false,
+			test_first, false, deadline, timings);
+	} else if (!locked && lock_fd >= 0 && !lock_queue(lock_fd, deadline)) {
+		exit_code = give_up_request(&queue, name, &by_other);
+	} else {
+		exit_code = wait_for_request(&queue, state, display, name,
+			&by_other, deadline, timings);
+	}
+
+	remove_owner(&queue, name, owner_fd);
+	close_apply_lock(lock_fd);
+	if (by_other && exit_code == EXIT_SUCCESS) {
+		// The new state was sent to every client
+		exit_code = dispatch_exit_code(roundtrip_until(display, deadline));
+	}
+	// Requests are applied from the queue, not from the heads
+	reset_heads(state);
+	return exit_code;
+}
@@ -0,0 +1,509 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "randr.h"
+
+#define MAX_CLIENTS 64
+#define MAX_REQUEST_SIZE 65536
+
+/*
+ * Clients send their arguments as a sequence of NUL-terminated strings and
+ * shut down the write side of the socket. The daemon replies with records
+ * made of a one byte tag, a 32-bit length and a payload: standard output,
+ * standard error, and finally the exit code as a 32-bit integer. Client
+ * sockets are non-blocking, replies are written as the poll loop finds them
+ * writable so that a client which stops reading only stalls itself.
+ */
+enum daemon_record {
+	DAEMON_RECORD_STDOUT = 'o',
+	DAEMON_RECORD_STDERR = 'e',
+	DAEMON_RECORD_EXIT = 'x',
+};
+
+struct daemon_client {
+	struct randr_state *state;
+	int fd;
+	struct wl_list link;
+
+	char *req;
+	size_t req_len, req_cap;
+	bool ready; // request fully received
+
+	struct buffer out;
+	FILE *err_file;
+	char *err;
+	size_t err_len;
+
+	struct buffer reply; // records, once the request is served
+	size_t reply_sent;
+	bool replying;
+};
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static bool get_socket_path(struct sockaddr_un *addr) {
+	addr->sun_family = AF_UNIX;
+	return get_runtime_path(addr->sun_path, sizeof(addr->sun_path), ".sock");
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+	char *cur = data;
+	while (size > 0) {
+		ssize_t n = read(fd, cur, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		cur += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void append_record(struct buffer *buf, enum daemon_record type,
+		const void *data, uint32_t size) {
+	char header[1 + sizeof(size)];
+	header[0] = type;
+	memcpy(&header[1], &size, sizeof(size));
+	buffer_append(buf, header, sizeof(header));
+	buffer_append(buf, data, size);
+}
+
+bool daemon_forward(int argc, char *argv[], int *exit_code) {
+	struct sockaddr_un addr = {0};
+	if (!get_socket_path(&addr)) {
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	*exit_code = EXIT_FAILURE;
+	for (int i = 1; i < argc; i++) {
+		if (!write_all(fd, argv[i], strlen(argv[i]) + 1)) {
+			fprintf(stderr, "failed to send request to daemon\n");
+			close(fd);
+			return true;
+		}
+	}
+	shutdown(fd, SHUT_WR);
+
+	bool done = false;
+	while (!done) {
+		char header[1 + sizeof(uint32_t)];
+		uint32_t size;
+		if (!read_all(fd, header, sizeof(header))) {
+			break;
+		}
+		memcpy(&size, &header[1], sizeof(size));
+
+		char *payload = malloc(size + 1);
+		if (payload == NULL || !read_all(fd, payload, size)) {
+			free(payload);
+			break;
+		}
+
+		switch (header[0]) {
+		case DAEMON_RECORD_STDOUT:
+			fwrite(payload, 1, size, stdout);
+			break;
+		case DAEMON_RECORD_STDERR:
+			fwrite(payload, 1, size, stderr);
+			break;
+		case DAEMON_RECORD_EXIT:
+			if (size == sizeof(int32_t)) {
+				int32_t code;
+				memcpy(&code, payload, sizeof(code));
+				*exit_code = code;
+			}
+			done = true;
+			break;
+		}
+		free(payload);
+	}
+	close(fd);
+
+	if (!done) {
+		fprintf(stderr, "lost connection to daemon\n");
+	}
+	return true;
+}
+
+static void destroy_client(struct daemon_client *client) {
+	wl_list_remove(&client->link);
+	close(client->fd);
+	buffer_finish(&client->out);
+	buffer_finish(&client->reply);
+	if (client->err_file != NULL) {
+		fclose(client->err_file);
+	}
+	free(client->err);
+	free(client->req);
+	free(client);
+}
+
+// Writes as much of the reply as the socket takes, the rest when it is
+// writable again
+static void flush_reply(struct daemon_client *client) {
+	while (client->reply_sent < client->reply.len) {
+		ssize_t n = write(client->fd,
+			client->reply.data + client->reply_sent,
+			client->reply.len - client->reply_sent);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && errno == EAGAIN) {
+			return;
+		} else if (n < 0) {
+			break;
+		}
+		client->reply_sent += n;
+	}
+	destroy_client(client);
+}
+
+static void send_reply(struct daemon_client *client, int exit_code) {
+	fclose(client->err_file);
+	client->err_file = NULL;
+
+	int32_t code = exit_code;
+	if (client->out.failed) {
+		code = EXIT_FAILURE;
+	} else if (client->out.len > 0) {
+		append_record(&client->reply, DAEMON_RECORD_STDOUT,
+			client->out.data, client->out.len);
+	}
+	if (client->err_len > 0) {
+		append_record(&client->reply, DAEMON_RECORD_STDERR,
+			client->err, client->err_len);
+	}
+	append_record(&client->reply, DAEMON_RECORD_EXIT, &code, sizeof(code));
+	buffer_finish(&client->out);
+	if (client->reply.failed) {
+		destroy_client(client);
+		return;
+	}
+
+	client->replying = true;
+	flush_reply(client);
+}
+
+static int run_request(struct daemon_client *client,
+		struct wl_display *display) {
+	struct randr_state *state = client->state;
+
+	int argc = 1;
+	for (size_t i = 0; i < client->req_len; i++) {
+		if (client->req[i] == '\0') {
+			argc++;
+		}
+	}
+	char **argv = calloc(argc + 1, sizeof(*argv));
+	if (argv == NULL) {
+		fprintf(client->err_file, "failed to allocate request\n");
+		return EXIT_FAILURE;
+	}
+	argv[0] = "wlr-randr";
+	char *cur = client->req;
+	for (int i = 1; i < argc; i++) {
+		argv[i] = cur;
+		cur += strlen(cur) + 1;
+	}
+
+	struct layout_snapshot original;
+	if (!take_layout_snapshot(state, &original)) {
+		free(argv);
+		fprintf(client->err_file, "failed to allocate request\n");
+		return EXIT_FAILURE;
+	}
+
+	set_error_file(client->err_file);
+	opterr = 0;
+	struct randr_command cmd = {0};
+	bool ok = parse_command(state, argc, argv, &cmd);
+	if (ok && cmd.daemon) {
+		log_error("a daemon is already running\n");
+		ok = false;
+	} else if (ok && cmd.watch) {
+		log_error("--watch cannot be served by the daemon\n");
+		ok = false;
+	} else if (ok && cmd.confirm) {
+		log_error("--confirm cannot be served by the daemon\n");
+		ok = false;
+	} else if (ok && cmd.power) {
+		log_error("--power cannot be served by the daemon\n");
+		ok = false;
+	} else if (ok && cmd.stdin_commands) {
+		log_error("--stdin-commands cannot be served by the daemon\n");
+		ok = false;
+	}
+	opterr = 1;
+
+	// Applies wait for their result, and for other processes applying
+	// at the same time, see coordinator.c
+	int exit_code = EXIT_SUCCESS;
+	if (!ok) {
+		exit_code = EXIT_FAILURE;
+	} else if (cmd.help) {
+		fprintf(client->err_file, "%s", usage);
+	} else if (cmd.changed) {
+		exit_code = run_transaction(state, display, &original, &cmd);
+	} else {
+		print_state_format(state, cmd.format, &cmd.query, &client->out);
+	}
+	set_error_file(NULL);
+
+	// Parsing the request edits the heads in place, go back to the state
+	// advertised by the compositor
+	reset_heads(state);
+	finish_layout_snapshot(&original);
+	free(argv);
+	return exit_code;
+}
+
+static void handle_request(struct daemon_client *client,
+		struct wl_display *display) {
+	client->err_file = open_memstream(&client->err, &client->err_len);
+	if (client->err_file == NULL) {
+		destroy_client(client);
+		return;
+	}
+
+	send_reply(client, run_request(client, display));
+}
+
+static void read_client(struct daemon_client *client) {
+	if (client->req_len == client->req_cap) {
+		if (client->req_cap >= MAX_REQUEST_SIZE) {
+			destroy_client(client);
+			return;
+		}
+		size_t cap = client->req_cap > 0 ? 2 * client->req_cap : 256;
+		char *req = realloc(client->req, cap);
+		if (req == NULL) {
+			destroy_client(client);
+			return;
+		}
+		client->req = req;
+		client->req_cap = cap;
+	}
+
+	ssize_t n = read(client->fd, client->req + client->req_len,
+		client->req_cap - client->req_len);
+	if (n < 0) {
+		if (errno != EINTR && errno != EAGAIN) {
+			destroy_client(client);
+		}
+		return;
+	} else if (n > 0) {
+		client->req_len += n;
+		return;
+	}
+
+	// The request must end with the terminator of its last argument
+	if (client->req_len > 0 && client->req[client->req_len - 1] != '\0') {
+		destroy_client(client);
+		return;
+	}
+	client->ready = true;
+}
+
+static void accept_client(struct randr_state *state, struct wl_list *clients,
+		int listen_fd) {
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) {
+		return;
+	}
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ||
+			wl_list_length(clients) >= MAX_CLIENTS) {
+		close(fd);
+		return;
+	}
+
+	struct daemon_client *client = calloc(1, sizeof(*client));
+	if (client == NULL) {
+		close(fd);
+		return;
+	}
+	client->state = state;
+	client->fd = fd;
+	wl_list_insert(clients->prev, &client->link);
+}
+
+static struct daemon_client *next_ready_client(struct wl_list *clients) {
+	struct daemon_client *client;
+	wl_list_for_each(client, clients, link) {
+		if (client->ready) {
+			return client;
+		}
+	}
+	return NULL;
+}
+
+static int create_listen_socket(const struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0) {
+		fprintf(stderr, "a daemon is already listening on %s\n",
+			addr->sun_path);
+		close(fd);
+		return -1;
+	}
+	unlink(addr->sun_path);
+
+	if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, MAX_CLIENTS) != 0) {
+		perror("listen");
+		unlink(addr->sun_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void daemon_handle_done(void *data, struct randr_state *state) {
+	struct cache_writer *cache = data;
+	write_cache(cache, state);
+}
+
+static const struct randr_state_listener cache_listener = {
+	.done = daemon_handle_done,
+};
+
+static void handle_signal(int sig) {
+	daemon_stop = 1;
+}
+
+int run_daemon(struct randr_state *state, struct wl_display *display,
+		const struct randr_command *cmd) {
+	struct sockaddr_un addr = {0};
+	if (!get_socket_path(&addr)) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set or too long\n");
+		return EXIT_FAILURE;
+	}
+
+	int listen_fd = create_listen_socket(&addr);
+	if (listen_fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	struct sigaction sa = { .sa_handler = handle_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	struct wl_list clients;
+	wl_list_init(&clients);
+
+	struct cache_writer cache = { .lock_fd = -1 };
+	if (cmd->cache && !start_cache(&cache)) {
+		unlink(addr.sun_path);
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+	if (cmd->cache) {
+		state->listener = &cache_listener;
+		state->listener_data = &cache;
+		write_cache(&cache, state);
+	}
+
+	struct auto_profile auto_profile = {0};
+	int exit_code = EXIT_SUCCESS;
+	while (!daemon_stop) {
+		// Profiles are applied in between requests
+		if (cmd->auto_profile) {
+			update_auto_profile(&auto_profile, state, display,
+				cmd->apply_timeout);
+		}
+
+		// Serve one request at a time, applies are waited for
+		struct daemon_client *client = next_ready_client(&clients);
+		if (client != NULL) {
+			client->ready = false;
+			handle_request(client, display);
+		}
+
+		struct pollfd fds[2 + MAX_CLIENTS];
+		struct daemon_client *polled[MAX_CLIENTS];
+		size_t fds_len = 1, polled_len = 0;
+		fds[fds_len++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+		wl_list_for_each(client, &clients, link) {
+			if (client->ready) {
+				continue;
+			}
+			fds[fds_len++] = (struct pollfd){
+				.fd = client->fd,
+				.events = client->replying ? POLLOUT : POLLIN,
+			};
+			polled[polled_len++] = client;
+		}
+
+		double deadline = next_ready_client(&clients) != NULL ?
+			timings_now() : -1;
+		if (cmd->cache) {
+			double next_touch = touch_cache(&cache);
+			deadline = deadline < 0 ? next_touch : deadline;
+		}
+		int n = poll_display(display, fds, fds_len, deadline);
+		if (n < 0) {
+			exit_code = EXIT_FAILURE;
+			goto out;
+		} else if (n == 0) {
+			continue;
+		}
+
+		for (size_t i = 0; i < polled_len; i++) {
+			if (polled[i]->replying) {
+				if (fds[2 + i].revents != 0) {
+					flush_reply(polled[i]);
+				}
+			} else if (fds[2 + i].revents & (POLLIN | POLLHUP)) {
+				read_client(polled[i]);
+			} else if (fds[2 + i].revents & POLLERR) {
+				destroy_client(polled[i]);
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			accept_client(state, &clients, listen_fd);
+		}
+	}
+
+out:;
+	struct daemon_client *client, *tmp;
+	wl_list_for_each_safe(client, tmp, &clients, link) {
+		destroy_client(client);
+	}
+	if (cmd->cache) {
+		state->listener = NULL;
+		state->listener_data = NULL;
+		finish_cache(&cache);
+	}
+	unlink(addr.sun_path);
+	close(listen_fd);
+	return exit_code;
+}
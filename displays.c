@@ -0,0 +1,416 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * With several displays, one process is forked per display. Each of them
+ * carries on as if wlr-randr had been started with WAYLAND_DISPLAY pointing
+ * to its display, so that they all connect, enumerate and apply at the same
+ * time. The parent collects their output and prints it per display once
+ * they are all done.
+ */
+
+struct display_job {
+	const char *name;
+	pid_t pid;
+	int out_fd, err_fd; // -1 once closed
+	struct buffer out, err;
+	int status;
+};
+
+bool add_display(struct display_list *displays, const char *name) {
+	char **names = realloc(displays->names,
+		(displays->len + 1) * sizeof(*names));
+	if (names == NULL) {
+		return false;
+	}
+	displays->names = names;
+	displays->names[displays->len] = strdup(name);
+	if (displays->names[displays->len] == NULL) {
+		return false;
+	}
+	displays->len++;
+	return true;
+}
+
+// Sockets of compositors which went away without cleaning up are refused
+static bool display_alive(const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	bool alive = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+	close(fd);
+	return alive;
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool scan_displays(struct display_list *displays) {
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+		return false;
+	}
+	DIR *dir = opendir(runtime_dir);
+	if (dir == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", runtime_dir,
+			strerror(errno));
+		return false;
+	}
+
+	bool ok = true;
+	struct dirent *entry;
+	while (ok && (entry = readdir(dir)) != NULL) {
+		const char *name = entry->d_name;
+		if (strncmp(name, "wayland-", strlen("wayland-")) != 0) {
+			continue;
+		}
+
+		char path[PATH_MAX];
+		struct stat st;
+		int n = snprintf(path, sizeof(path), "%s/%s", runtime_dir, name);
+		if (n < 0 || (size_t)n >= sizeof(path) || lstat(path, &st) != 0 ||
+				!S_ISSOCK(st.st_mode) || !display_alive(path)) {
+			continue;
+		}
+		ok = add_display(displays, name);
+	}
+	closedir(dir);
+
+	if (!ok) {
+		fprintf(stderr, "failed to allocate display list\n");
+		return false;
+	} else if (displays->len == 0) {
+		fprintf(stderr, "no Wayland display found in %s\n", runtime_dir);
+		return false;
+	}
+	qsort(displays->names, displays->len, sizeof(*displays->names),
+		compare_names);
+	return true;
+}
+
+// Checks the displays given with --display or --all-displays
+bool collect_displays(struct randr_command *cmd) {
+	struct display_list *displays = &cmd->displays;
+	displays->format = cmd->format;
+
+	if (displays->all && displays->len > 0) {
+		fprintf(stderr, "--display and --all-displays are exclusive\n");
+		finish_displays(displays);
+		return false;
+	}
+	if (displays->all && !scan_displays(displays)) {
+		finish_displays(displays);
+		return false;
+	}
+	if ((displays->all || displays->len > 1) && cmd->exclusive != NULL) {
+		fprintf(stderr, "--%s cannot be used with several displays\n",
+			cmd->exclusive);
+		finish_displays(displays);
+		return false;
+	}
+	return true;
+}
+
+void finish_displays(struct display_list *displays) {
+	for (size_t i = 0; i < displays->len; i++) {
+		free(displays->names[i]);
+	}
+	free(displays->names);
+	*displays = (struct display_list){0};
+}
+
+// Forward complete lines of standard error, prefixed with the display
+static void flush_errors(struct display_job *job, bool all) {
+	size_t start = 0;
+	for (size_t i = 0; i < job->err.len; i++) {
+		if (job->err.data[i] != '\n') {
+			continue;
+		}
+		fprintf(stderr, "%s: %.*s\n", job->name, (int)(i - start),
+			&job->err.data[start]);
+		start = i + 1;
+	}
+	if (all && start < job->err.len) {
+		fprintf(stderr, "%s: %.*s\n", job->name, (int)(job->err.len - start),
+			&job->err.data[start]);
+		start = job->err.len;
+	}
+	if (start > 0) {
+		memmove(job->err.data, &job->err.data[start], job->err.len - start);
+		job->err.len -= start;
+	}
+}
+
+static bool read_job(int *fd, struct buffer *buf) {
+	char data[4096];
+	ssize_t n = read(*fd, data, sizeof(data));
+	if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return true;
+	} else if (n <= 0) {
+		close(*fd);
+		*fd = -1;
+		return n == 0;
+	}
+	buffer_append(buf, data, n);
+	return !buf->failed;
+}
+
+static bool start_job(struct display_job *jobs, size_t index) {
+	struct display_job *job = &jobs[index];
+	int out[2], err[2];
+	if (pipe(out) != 0) {
+		perror("pipe");
+		return false;
+	}
+	if (pipe(err) != 0) {
+		perror("pipe");
+		close(out[0]);
+		close(out[1]);
+		return false;
+	}
+
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("fork");
+		close(out[0]);
+		close(out[1]);
+		close(err[0]);
+		close(err[1]);
+		return false;
+	} else if (job->pid == 0) {
+		for (size_t i = 0; i < index; i++) {
+			close(jobs[i].out_fd);
+			close(jobs[i].err_fd);
+		}
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		close(out[0]);
+		close(out[1]);
+		close(err[0]);
+		close(err[1]);
+		setenv("WAYLAND_DISPLAY", job->name, 1);
+		return true;
+	}
+
+	close(out[1]);
+	close(err[1]);
+	job->out_fd = out[0];
+	job->err_fd = err[0];
+	return true;
+}
+
+// Output of machine-readable formats is a single value, merge them in a map
+static void encode_jobs(struct display_job *jobs, size_t len,
+		struct encoder *enc, enum randr_format format) {
+	encode_begin_map(enc, len);
+	for (size_t i = 0; i < len; i++) {
+		struct display_job *job = &jobs[i];
+		size_t out_len = job->out.len;
+		if (format == RANDR_FORMAT_JSON_COMPACT && out_len > 0 &&
+				job->out.data[out_len - 1] == '\n') {
+			out_len--;
+		}
+		encode_key(enc, job->name);
+		if (out_len > 0) {
+			encode_raw(enc, job->out.data, out_len);
+		} else {
+			encode_null(enc);
+		}
+	}
+	encode_end_map(enc);
+	encode_finish(enc);
+}
+
+static void print_jobs(struct display_job *jobs, size_t len,
+		enum randr_format format) {
+	struct buffer buf = {0};
+	struct encoder enc;
+	if (encoder_init(&enc, format, &buf)) {
+		encode_jobs(jobs, len, &enc, format);
+		buffer_write(&buf, STDOUT_FILENO);
+		buffer_finish(&buf);
+		return;
+	}
+
+	bool json = format == RANDR_FORMAT_JSON;
+	if (json) {
+		buffer_append_str(&buf, "{");
+	}
+	for (size_t i = 0; i < len; i++) {
+		struct display_job *job = &jobs[i];
+		size_t out_len = job->out.len;
+		while (out_len > 0 && (job->out.data[out_len - 1] == '\n' ||
+				job->out.data[out_len - 1] == ' ')) {
+			out_len--;
+		}
+
+		if (json) {
+			if (i > 0) {
+				buffer_append_str(&buf, ",");
+			}
+			buffer_append_json_string(&buf, job->name);
+			buffer_append_str(&buf, ":");
+			if (out_len > 0) {
+				buffer_append(&buf, job->out.data, out_len);
+			} else {
+				buffer_append_str(&buf, "null");
+			}
+			continue;
+		} else if (out_len == 0) {
+			continue;
+		}
+
+		buffer_printf(&buf, "%s:\n", job->name);
+		size_t start = 0;
+		for (size_t j = 0; j <= out_len; j++) {
+			if (j < out_len && job->out.data[j] != '\n') {
+				continue;
+			}
+			buffer_append_str(&buf, "  ");
+			buffer_append(&buf, &job->out.data[start], j - start);
+			buffer_append_str(&buf, "\n");
+			start = j + 1;
+		}
+	}
+	if (json) {
+		buffer_append_str(&buf, "}\n");
+	}
+	buffer_write(&buf, STDOUT_FILENO);
+	buffer_finish(&buf);
+}
+
+/*
+ * Returns false in the child processes, and in this process if there is only
+ * one display to take care of: the caller should then carry on with it.
+ */
+bool run_displays(const struct display_list *displays, int *exit_code) {
+	if (!displays->all && displays->len <= 1) {
+		if (displays->len == 1) {
+			setenv("WAYLAND_DISPLAY", displays->names[0], 1);
+		}
+		return false;
+	}
+
+	struct display_job *jobs = calloc(displays->len, sizeof(*jobs));
+	struct pollfd *fds = calloc(2 * displays->len, sizeof(*fds));
+	if (jobs == NULL || fds == NULL) {
+		fprintf(stderr, "failed to allocate display jobs\n");
+		free(jobs);
+		free(fds);
+		*exit_code = EXIT_FAILURE;
+		return true;
+	}
+
+	size_t started = 0;
+	bool ok = true, timed_out = false;
+	for (; started < displays->len; started++) {
+		jobs[started].name = displays->names[started];
+		if (!start_job(jobs, started)) {
+			ok = false;
+			break;
+		} else if (jobs[started].pid == 0) {
+			free(jobs);
+			free(fds);
+			return false;
+		}
+	}
+
+	while (1) {
+		size_t nfds = 0;
+		for (size_t i = 0; i < started; i++) {
+			if (jobs[i].out_fd >= 0) {
+				fds[nfds++] = (struct pollfd){
+					.fd = jobs[i].out_fd, .events = POLLIN };
+			}
+			if (jobs[i].err_fd >= 0) {
+				fds[nfds++] = (struct pollfd){
+					.fd = jobs[i].err_fd, .events = POLLIN };
+			}
+		}
+		if (nfds == 0) {
+			break;
+		}
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			ok = false;
+			break;
+		}
+
+		for (size_t i = 0; i < started; i++) {
+			struct display_job *job = &jobs[i];
+			for (size_t j = 0; j < nfds; j++) {
+				if (!(fds[j].revents & (POLLIN | POLLHUP | POLLERR))) {
+					continue;
+				}
+				if (fds[j].fd == job->out_fd) {
+					ok = read_job(&job->out_fd, &job->out) && ok;
+				} else if (fds[j].fd == job->err_fd) {
+					ok = read_job(&job->err_fd, &job->err) && ok;
+					flush_errors(job, job->err_fd < 0);
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < started; i++) {
+		struct display_job *job = &jobs[i];
+		if (job->out_fd >= 0) {
+			close(job->out_fd);
+		}
+		if (job->err_fd >= 0) {
+			close(job->err_fd);
+		}
+		flush_errors(job, true);
+		while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR) {
+			// Try again
+		}
+		if (WIFEXITED(job->status) &&
+				WEXITSTATUS(job->status) == EXIT_TIMEOUT) {
+			timed_out = true;
+		} else if (!WIFEXITED(job->status) ||
+				WEXITSTATUS(job->status) != EXIT_SUCCESS) {
+			ok = false;
+		}
+	}
+
+	print_jobs(jobs, started, displays->format);
+	for (size_t i = 0; i < started; i++) {
+		buffer_finish(&jobs[i].out);
+		buffer_finish(&jobs[i].err);
+	}
+	free(jobs);
+	free(fds);
+	// Time-outs are only reported as such if nothing else went wrong
+	if (!ok) {
+		*exit_code = EXIT_FAILURE;
+	} else {
+		*exit_code = timed_out ? EXIT_TIMEOUT : EXIT_SUCCESS;
+	}
+	return true;
+}
@@ -0,0 +1,563 @@
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Serializers for machine consumers, sharing one schema:
+ *
+ *     [
+ *       {
+ *         "name", "description", "make", "model", "serial": string or null,
+ *         "physical_size": {"width", "height"} (mm),
+ *         "enabled": bool,
+ *         "modes": [
+ *           {"width", "height", "refresh_mhz", "preferred", "current"}
+ *         ],
+ *         "position": {"x", "y"} or null,
+ *         "transform": string or null,
+ *         "scale_fixed": int (1/256ths, like wl_fixed_t) or null,
+ *         "adaptive_sync": bool or null
+ *       }
+ *     ]
+ *
+ * Fields are always present and always in this order, null when they don't
+ * apply. --fields leaves some out, and --current-mode-only all modes but the
+ * current one. Numbers are integers so that no float is ever formatted.
+ */
+
+struct encoder_impl {
+	void (*begin_array)(struct encoder *enc, size_t len);
+	void (*end_array)(struct encoder *enc);
+	void (*begin_map)(struct encoder *enc, size_t len);
+	void (*end_map)(struct encoder *enc);
+	void (*key)(struct encoder *enc, const char *key);
+	void (*string)(struct encoder *enc, const char *str);
+	void (*integer)(struct encoder *enc, int64_t value);
+	void (*boolean)(struct encoder *enc, bool value);
+	void (*null)(struct encoder *enc);
+	void (*raw)(struct encoder *enc, const char *data, size_t size);
+	void (*finish)(struct encoder *enc);
+};
+
+static void append_byte(struct buffer *buf, uint8_t byte) {
+	buffer_append(buf, (const char *)&byte, 1);
+}
+
+// Big-endian, as both CBOR and MessagePack want
+static void append_be(struct buffer *buf, uint64_t value, size_t size) {
+	char data[8];
+	for (size_t i = 0; i < size; i++) {
+		data[i] = value >> (8 * (size - 1 - i));
+	}
+	buffer_append(buf, data, size);
+}
+
+// Compact JSON
+
+static void json_separator(struct encoder *enc) {
+	if (enc->after_key) {
+		enc->after_key = false;
+		return;
+	}
+	if (enc->depth > 0 && enc->depth <= ENCODER_MAX_DEPTH) {
+		if (enc->nonempty[enc->depth - 1]) {
+			buffer_append_str(enc->buf, ",");
+		}
+		enc->nonempty[enc->depth - 1] = true;
+	}
+}
+
+static void json_open(struct encoder *enc, const char *str) {
+	json_separator(enc);
+	buffer_append_str(enc->buf, str);
+	if (enc->depth < ENCODER_MAX_DEPTH) {
+		enc->nonempty[enc->depth] = false;
+	}
+	enc->depth++;
+}
+
+static void json_close(struct encoder *enc, const char *str) {
+	buffer_append_str(enc->buf, str);
+	enc->depth--;
+}
+
+static void json_begin_array(struct encoder *enc, size_t len) {
+	json_open(enc, "[");
+}
+
+static void json_end_array(struct encoder *enc) {
+	json_close(enc, "]");
+}
+
+static void json_begin_map(struct encoder *enc, size_t len) {
+	json_open(enc, "{");
+}
+
+static void json_end_map(struct encoder *enc) {
+	json_close(enc, "}");
+}
+
+static void json_key(struct encoder *enc, const char *key) {
+	json_separator(enc);
+	buffer_append_json_string(enc->buf, key);
+	buffer_append_str(enc->buf, ":");
+	enc->after_key = true;
+}
+
+static void json_string(struct encoder *enc, const char *str) {
+	json_separator(enc);
+	buffer_append_json_string(enc->buf, str);
+}
+
+static void json_integer(struct encoder *enc, int64_t value) {
+	json_separator(enc);
+	buffer_append_int(enc->buf, value);
+}
+
+static void json_boolean(struct encoder *enc, bool value) {
+	json_separator(enc);
+	buffer_append_str(enc->buf, value ? "true" : "false");
+}
+
+static void json_null(struct encoder *enc) {
+	json_separator(enc);
+	buffer_append_str(enc->buf, "null");
+}
+
+static void json_raw(struct encoder *enc, const char *data, size_t size) {
+	json_separator(enc);
+	buffer_append(enc->buf, data, size);
+}
+
+static void json_compact_finish(struct encoder *enc) {
+	buffer_append_str(enc->buf, "\n");
+}
+
+static const struct encoder_impl json_compact_impl = {
+	.begin_array = json_begin_array,
+	.end_array = json_end_array,
+	.begin_map = json_begin_map,
+	.end_map = json_end_map,
+	.key = json_key,
+	.string = json_string,
+	.integer = json_integer,
+	.boolean = json_boolean,
+	.null = json_null,
+	.raw = json_raw,
+	.finish = json_compact_finish,
+};
+
+// CBOR (RFC 8949), definite lengths only
+
+enum cbor_major {
+	CBOR_UINT = 0,
+	CBOR_NEGINT = 1,
+	CBOR_TEXT = 3,
+	CBOR_ARRAY = 4,
+	CBOR_MAP = 5,
+};
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+
+static void cbor_head(struct buffer *buf, enum cbor_major major,
+		uint64_t value) {
+	uint8_t type = major << 5;
+	if (value < 24) {
+		append_byte(buf, type | value);
+	} else if (value <= UINT8_MAX) {
+		append_byte(buf, type | 24);
+		append_be(buf, value, 1);
+	} else if (value <= UINT16_MAX) {
+		append_byte(buf, type | 25);
+		append_be(buf, value, 2);
+	} else if (value <= UINT32_MAX) {
+		append_byte(buf, type | 26);
+		append_be(buf, value, 4);
+	} else {
+		append_byte(buf, type | 27);
+		append_be(buf, value, 8);
+	}
+}
+
+static void cbor_begin_array(struct encoder *enc, size_t len) {
+	cbor_head(enc->buf, CBOR_ARRAY, len);
+}
+
+static void cbor_begin_map(struct encoder *enc, size_t len) {
+	cbor_head(enc->buf, CBOR_MAP, len);
+}
+
+static void cbor_end(struct encoder *enc) {
+	// Lengths are given upfront
+}
+
+static void cbor_string(struct encoder *enc, const char *str) {
+	if (str == NULL) {
+		append_byte(enc->buf, CBOR_NULL);
+		return;
+	}
+	size_t len = strlen(str);
+	cbor_head(enc->buf, CBOR_TEXT, len);
+	buffer_append(enc->buf, str, len);
+}
+
+static void cbor_integer(struct encoder *enc, int64_t value) {
+	if (value >= 0) {
+		cbor_head(enc->buf, CBOR_UINT, value);
+	} else {
+		cbor_head(enc->buf, CBOR_NEGINT, -1 - value);
+	}
+}
+
+static void cbor_boolean(struct encoder *enc, bool value) {
+	append_byte(enc->buf, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+static void cbor_null(struct encoder *enc) {
+	append_byte(enc->buf, CBOR_NULL);
+}
+
+static void binary_raw(struct encoder *enc, const char *data, size_t size) {
+	buffer_append(enc->buf, data, size);
+}
+
+static void binary_finish(struct encoder *enc) {
+	// No trailing newline in binary output
+}
+
+static const struct encoder_impl cbor_impl = {
+	.begin_array = cbor_begin_array,
+	.end_array = cbor_end,
+	.begin_map = cbor_begin_map,
+	.end_map = cbor_end,
+	.key = cbor_string,
+	.string = cbor_string,
+	.integer = cbor_integer,
+	.boolean = cbor_boolean,
+	.null = cbor_null,
+	.raw = binary_raw,
+	.finish = binary_finish,
+};
+
+// MessagePack
+
+static void msgpack_begin(struct buffer *buf, size_t len, uint8_t fix,
+		uint8_t type16, uint8_t type32) {
+	if (len < 16) {
+		append_byte(buf, fix | len);
+	} else if (len <= UINT16_MAX) {
+		append_byte(buf, type16);
+		append_be(buf, len, 2);
+	} else {
+		append_byte(buf, type32);
+		append_be(buf, len, 4);
+	}
+}
+
+static void msgpack_begin_array(struct encoder *enc, size_t len) {
+	msgpack_begin(enc->buf, len, 0x90, 0xdc, 0xdd);
+}
+
+static void msgpack_begin_map(struct encoder *enc, size_t len) {
+	msgpack_begin(enc->buf, len, 0x80, 0xde, 0xdf);
+}
+
+static void msgpack_end(struct encoder *enc) {
+	// Lengths are given upfront
+}
+
+static void msgpack_string(struct encoder *enc, const char *str) {
+	if (str == NULL) {
+		append_byte(enc->buf, 0xc0);
+		return;
+	}
+	size_t len = strlen(str);
+	if (len < 32) {
+		append_byte(enc->buf, 0xa0 | len);
+	} else if (len <= UINT8_MAX) {
+		append_byte(enc->buf, 0xd9);
+		append_be(enc->buf, len, 1);
+	} else if (len <= UINT16_MAX) {
+		append_byte(enc->buf, 0xda);
+		append_be(enc->buf, len, 2);
+	} else {
+		append_byte(enc->buf, 0xdb);
+		append_be(enc->buf, len, 4);
+	}
+	buffer_append(enc->buf, str, len);
+}
+
+static void msgpack_integer(struct encoder *enc, int64_t value) {
+	if (value >= 0 && value <= 0x7f) {
+		append_byte(enc->buf, value); // positive fixint
+	} else if (value < 0 && value >= -32) {
+		append_byte(enc->buf, (uint8_t)value); // negative fixint
+	} else if (value > 0) {
+		if (value <= UINT8_MAX) {
+			append_byte(enc->buf, 0xcc);
+			append_be(enc->buf, value, 1);
+		} else if (value <= UINT16_MAX) {
+			append_byte(enc->buf, 0xcd);
+			append_be(enc->buf, value, 2);
+		} else if (value <= UINT32_MAX) {
+			append_byte(enc->buf, 0xce);
+			append_be(enc->buf, value, 4);
+		} else {
+			append_byte(enc->buf, 0xcf);
+			append_be(enc->buf, value, 8);
+		}
+	} else if (value >= INT8_MIN) {
+		append_byte(enc->buf, 0xd0);
+		append_be(enc->buf, (uint64_t)value, 1);
+	} else if (value >= INT16_MIN) {
+		append_byte(enc->buf, 0xd1);
+		append_be(enc->buf, (uint64_t)value, 2);
+	} else if (value >= INT32_MIN) {
+		append_byte(enc->buf, 0xd2);
+		append_be(enc->buf, (uint64_t)value, 4);
+	} else {
+		append_byte(enc->buf, 0xd3);
+		append_be(enc->buf, (uint64_t)value, 8);
+	}
+}
+
+static void msgpack_boolean(struct encoder *enc, bool value) {
+	append_byte(enc->buf, value ? 0xc3 : 0xc2);
+}
+
+static void msgpack_null(struct encoder *enc) {
+	append_byte(enc->buf, 0xc0);
+}
+
+static const struct encoder_impl msgpack_impl = {
+	.begin_array = msgpack_begin_array,
+	.end_array = msgpack_end,
+	.begin_map = msgpack_begin_map,
+	.end_map = msgpack_end,
+	.key = msgpack_string,
+	.string = msgpack_string,
+	.integer = msgpack_integer,
+	.boolean = msgpack_boolean,
+	.null = msgpack_null,
+	.raw = binary_raw,
+	.finish = binary_finish,
+};
+
+bool parse_format(const char *value, enum randr_format *format) {
+	if (strcmp(value, "text") == 0) {
+		*format = RANDR_FORMAT_TEXT;
+	} else if (strcmp(value, "json") == 0) {
+		*format = RANDR_FORMAT_JSON;
+	} else if (strcmp(value, "json-compact") == 0) {
+		*format = RANDR_FORMAT_JSON_COMPACT;
+	} else if (strcmp(value, "cbor") == 0) {
+		*format = RANDR_FORMAT_CBOR;
+	} else if (strcmp(value, "msgpack") == 0) {
+		*format = RANDR_FORMAT_MSGPACK;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Returns false for the formats which don't go through an encoder
+bool encoder_init(struct encoder *enc, enum randr_format format,
+		struct buffer *buf) {
+	*enc = (struct encoder){ .buf = buf };
+	switch (format) {
+	case RANDR_FORMAT_TEXT:
+	case RANDR_FORMAT_JSON:
+		return false;
+	case RANDR_FORMAT_JSON_COMPACT:
+		enc->impl = &json_compact_impl;
+		return true;
+	case RANDR_FORMAT_CBOR:
+		enc->impl = &cbor_impl;
+		return true;
+	case RANDR_FORMAT_MSGPACK:
+		enc->impl = &msgpack_impl;
+		return true;
+	}
+	return false;
+}
+
+void encode_begin_array(struct encoder *enc, size_t len) {
+	enc->impl->begin_array(enc, len);
+}
+
+void encode_end_array(struct encoder *enc) {
+	enc->impl->end_array(enc);
+}
+
+void encode_begin_map(struct encoder *enc, size_t len) {
+	enc->impl->begin_map(enc, len);
+}
+
+void encode_end_map(struct encoder *enc) {
+	enc->impl->end_map(enc);
+}
+
+void encode_key(struct encoder *enc, const char *key) {
+	enc->impl->key(enc, key);
+}
+
+void encode_string(struct encoder *enc, const char *str) {
+	enc->impl->string(enc, str);
+}
+
+void encode_integer(struct encoder *enc, int64_t value) {
+	enc->impl->integer(enc, value);
+}
+
+void encode_boolean(struct encoder *enc, bool value) {
+	enc->impl->boolean(enc, value);
+}
+
+void encode_null(struct encoder *enc) {
+	enc->impl->null(enc);
+}
+
+// Appends an already encoded value
+void encode_raw(struct encoder *enc, const char *data, size_t size) {
+	enc->impl->raw(enc, data, size);
+}
+
+void encode_finish(struct encoder *enc) {
+	enc->impl->finish(enc);
+}
+
+static void encode_size(struct encoder *enc, const char *key,
+		const char *x_key, int32_t x, const char *y_key, int32_t y) {
+	encode_key(enc, key);
+	encode_begin_map(enc, 2);
+	encode_key(enc, x_key);
+	encode_integer(enc, x);
+	encode_key(enc, y_key);
+	encode_integer(enc, y);
+	encode_end_map(enc);
+}
+
+static void encode_mode(struct encoder *enc, const struct randr_head *head,
+		const struct randr_mode *mode) {
+	encode_begin_map(enc, 5);
+	encode_key(enc, "width");
+	encode_integer(enc, mode->width);
+	encode_key(enc, "height");
+	encode_integer(enc, mode->height);
+	encode_key(enc, "refresh_mhz");
+	encode_integer(enc, mode->refresh);
+	encode_key(enc, "preferred");
+	encode_boolean(enc, mode->preferred);
+	encode_key(enc, "current");
+	encode_boolean(enc, head->mode == mode);
+	encode_end_map(enc);
+}
+
+static size_t count_fields(uint32_t fields) {
+	size_t len = 0;
+	for (; fields != 0; fields &= fields - 1) {
+		len++;
+	}
+	return len;
+}
+
+static void encode_head(struct encoder *enc, const struct randr_state *state,
+		const struct randr_query *query, const struct randr_head *head) {
+	uint32_t fields = query_fields(query);
+	encode_begin_map(enc, count_fields(fields));
+	if (fields & RANDR_FIELD_NAME) {
+		encode_key(enc, "name");
+		encode_string(enc, head->name);
+	}
+	if (fields & RANDR_FIELD_DESCRIPTION) {
+		encode_key(enc, "description");
+		encode_string(enc, head->description);
+	}
+	if (fields & RANDR_FIELD_MAKE) {
+		encode_key(enc, "make");
+		encode_string(enc, head->make);
+	}
+	if (fields & RANDR_FIELD_MODEL) {
+		encode_key(enc, "model");
+		encode_string(enc, head->model);
+	}
+	if (fields & RANDR_FIELD_SERIAL) {
+		encode_key(enc, "serial");
+		encode_string(enc, head->serial_number);
+	}
+	if (fields & RANDR_FIELD_PHYSICAL_SIZE) {
+		encode_size(enc, "physical_size", "width", head->phys_width,
+			"height", head->phys_height);
+	}
+	if (fields & RANDR_FIELD_ENABLED) {
+		encode_key(enc, "enabled");
+		encode_boolean(enc, head->enabled);
+	}
+
+	if (fields & RANDR_FIELD_MODES) {
+		encode_key(enc, "modes");
+		encode_begin_array(enc, query_modes_len(query, head));
+		if (query != NULL && query->current_mode_only) {
+			if (head->mode != NULL) {
+				encode_mode(enc, head, head->mode);
+			}
+		} else {
+			struct randr_mode *mode;
+			wl_list_for_each(mode, &head->modes, link) {
+				encode_mode(enc, head, mode);
+			}
+		}
+		encode_end_array(enc);
+	}
+
+	if (fields & RANDR_FIELD_POSITION) {
+		if (head->enabled) {
+			encode_size(enc, "position", "x", head->x, "y", head->y);
+		} else {
+			encode_key(enc, "position");
+			encode_null(enc);
+		}
+	}
+	if (fields & RANDR_FIELD_TRANSFORM) {
+		encode_key(enc, "transform");
+		if (head->enabled) {
+			encode_string(enc, output_transform_map[head->transform]);
+		} else {
+			encode_null(enc);
+		}
+	}
+	if (fields & RANDR_FIELD_SCALE) {
+		encode_key(enc, "scale_fixed");
+		if (head->enabled) {
+			encode_integer(enc, wl_fixed_from_double(head->scale));
+		} else {
+			encode_null(enc);
+		}
+	}
+
+	if (fields & RANDR_FIELD_ADAPTIVE_SYNC) {
+		encode_key(enc, "adaptive_sync");
+		if (head->enabled && state->version >= 4) {
+			encode_boolean(enc, head->adaptive_sync_state ==
+				ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED);
+		} else {
+			encode_null(enc);
+		}
+	}
+	encode_end_map(enc);
+}
+
+void encode_state(struct randr_state *state, const struct randr_query *query,
+		struct encoder *enc) {
+	encode_begin_array(enc, query_heads_len(query, state));
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (query_has_head(query, head)) {
+			encode_head(enc, state, query, head);
+		}
+	}
+	encode_end_array(enc);
+	encode_finish(enc);
+}
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Open addressing with linear probing. Several values may share a hash:
+ * lookups walk every entry with a matching hash and let the caller compare
+ * keys. Removal shifts the following entries back so that no tombstones
+ * are needed.
+ */
+
+uint32_t hash_string(const char *str) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (; *str != '\0'; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint64_t hash_bytes64(uint64_t hash, const void *data, size_t len) {
+	// FNV-1a, 64-bit
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211u;
+	}
+	return hash;
+}
+
+uint32_t hash_u64(uint64_t value) {
+	// Finalizer from MurmurHash3
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return (uint32_t)value;
+}
+
+uint32_t hash_ptr(const void *ptr) {
+	return hash_u64((uintptr_t)ptr);
+}
+
+void hash_table_finish(struct hash_table *table) {
+	free(table->entries);
+	*table = (struct hash_table){0};
+}
+
+static void insert_entry(struct hash_table *table, uint32_t hash,
+		void *value) {
+	size_t mask = table->cap - 1;
+	size_t pos = hash & mask;
+	while (table->entries[pos].value != NULL) {
+		pos = (pos + 1) & mask;
+	}
+	table->entries[pos].hash = hash;
+	table->entries[pos].value = value;
+	table->len++;
+}
+
+bool hash_table_insert(struct hash_table *table, uint32_t hash, void *value) {
+	if (2 * (table->len + 1) > table->cap) {
+		size_t cap = table->cap > 0 ? 2 * table->cap : 16;
+		struct hash_entry *entries = calloc(cap, sizeof(*entries));
+		if (entries == NULL) {
+			return false;
+		}
+
+		struct hash_table old = *table;
+		table->entries = entries;
+		table->cap = cap;
+		table->len = 0;
+		for (size_t i = 0; i < old.cap; i++) {
+			if (old.entries[i].value != NULL) {
+				insert_entry(table, old.entries[i].hash,
+					old.entries[i].value);
+			}
+		}
+		free(old.entries);
+	}
+
+	insert_entry(table, hash, value);
+	return true;
+}
+
+void hash_table_remove(struct hash_table *table, uint32_t hash,
+		const void *value) {
+	if (table->cap == 0) {
+		return;
+	}
+
+	size_t mask = table->cap - 1;
+	size_t pos = hash & mask;
+	while (table->entries[pos].value != value) {
+		if (table->entries[pos].value == NULL) {
+			return;
+		}
+		pos = (pos + 1) & mask;
+	}
+	table->entries[pos].value = NULL;
+	table->len--;
+
+	// Move back entries which would become unreachable
+	size_t hole = pos;
+	pos = (pos + 1) & mask;
+	while (table->entries[pos].value != NULL) {
+		size_t home = table->entries[pos].hash & mask;
+		if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+			table->entries[hole] = table->entries[pos];
+			table->entries[pos].value = NULL;
+			hole = pos;
+		}
+		pos = (pos + 1) & mask;
+	}
+}
+
+void *hash_table_first(const struct hash_table *table, uint32_t hash,
+		struct hash_iter *iter) {
+	if (table->cap == 0) {
+		return NULL;
+	}
+	iter->hash = hash;
+	iter->pos = hash & (table->cap - 1);
+	return hash_table_next(table, iter);
+}
+
+void *hash_table_next(const struct hash_table *table, struct hash_iter *iter) {
+	size_t mask = table->cap - 1;
+	while (table->entries[iter->pos].value != NULL) {
+		const struct hash_entry *entry = &table->entries[iter->pos];
+		iter->pos = (iter->pos + 1) & mask;
+		if (entry->hash == iter->hash) {
+			return entry->value;
+		}
+	}
+	return NULL;
+}
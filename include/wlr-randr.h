@@ -0,0 +1,136 @@
+#ifndef WLR_RANDR_H
+#define WLR_RANDR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libwlr-randr queries and configures the outputs of a compositor
+ * supporting wlr-output-management-unstable-v1, like the wlr-randr command
+ * does, from within another process.
+ *
+ * A struct wlr_randr is a connection to the compositor along with the last
+ * state it sent. The state is only updated by wlr_randr_dispatch() and
+ * wlr_randr_apply(), heads and modes stay valid until then. Errors are
+ * reported on stderr. Nothing here is thread-safe.
+ */
+
+struct wlr_randr;
+struct wlr_randr_head;
+struct wlr_randr_mode;
+
+enum wlr_randr_result {
+	WLR_RANDR_SUCCESS,
+	WLR_RANDR_FAILED,
+	WLR_RANDR_TIMEOUT,
+};
+
+// Same as --format
+enum wlr_randr_format {
+	WLR_RANDR_FORMAT_TEXT,
+	WLR_RANDR_FORMAT_JSON,
+	WLR_RANDR_FORMAT_JSON_COMPACT,
+	WLR_RANDR_FORMAT_CBOR,
+	WLR_RANDR_FORMAT_MSGPACK,
+};
+
+// Change notifications, all optional
+struct wlr_randr_listener {
+	// The compositor sent a new state, which is now the current one
+	void (*done)(void *data, struct wlr_randr *randr);
+	// The head is about to be removed
+	void (*head_removed)(void *data, struct wlr_randr_head *head);
+};
+
+/*
+ * Connects to a display, NULL for $WAYLAND_DISPLAY, and waits for the
+ * current state. Gives up after timeout_ms, unless it is 0. Returns NULL on
+ * error.
+ */
+struct wlr_randr *wlr_randr_connect(const char *display_name, int timeout_ms);
+void wlr_randr_disconnect(struct wlr_randr *randr);
+
+// Becomes readable when wlr_randr_dispatch() has something to do
+int wlr_randr_get_fd(struct wlr_randr *randr);
+/*
+ * Receives changes, waiting at most timeout_ms for them: -1 to wait for as
+ * long as it takes, 0 to only process what was already received. Returns
+ * WLR_RANDR_TIMEOUT if nothing arrived in time or a signal interrupted the
+ * wait.
+ */
+enum wlr_randr_result wlr_randr_dispatch(struct wlr_randr *randr,
+	int timeout_ms);
+void wlr_randr_set_listener(struct wlr_randr *randr,
+	const struct wlr_randr_listener *listener, void *data);
+// Changes every time the compositor sends a new state
+uint32_t wlr_randr_get_serial(struct wlr_randr *randr);
+
+/*
+ * Writes the state like wlr-randr prints it into a newly allocated buffer,
+ * to be freed with free().
+ */
+bool wlr_randr_encode(struct wlr_randr *randr, enum wlr_randr_format format,
+	char **data, size_t *len);
+
+// Iteration, pass NULL for the first one
+struct wlr_randr_head *wlr_randr_next_head(struct wlr_randr *randr,
+	struct wlr_randr_head *head);
+struct wlr_randr_head *wlr_randr_find_head(struct wlr_randr *randr,
+	const char *name);
+
+// Strings are NULL if the compositor didn't send them
+const char *wlr_randr_head_get_name(struct wlr_randr_head *head);
+const char *wlr_randr_head_get_description(struct wlr_randr_head *head);
+const char *wlr_randr_head_get_make(struct wlr_randr_head *head);
+const char *wlr_randr_head_get_model(struct wlr_randr_head *head);
+const char *wlr_randr_head_get_serial_number(struct wlr_randr_head *head);
+// In millimeters, 0 if unknown
+void wlr_randr_head_get_physical_size(struct wlr_randr_head *head,
+	int32_t *width, int32_t *height);
+bool wlr_randr_head_get_enabled(struct wlr_randr_head *head);
+// NULL if the head is disabled or uses a custom mode
+struct wlr_randr_mode *wlr_randr_head_get_mode(struct wlr_randr_head *head);
+void wlr_randr_head_get_position(struct wlr_randr_head *head,
+	int32_t *x, int32_t *y);
+// A wl_output_transform value
+int32_t wlr_randr_head_get_transform(struct wlr_randr_head *head);
+double wlr_randr_head_get_scale(struct wlr_randr_head *head);
+bool wlr_randr_head_get_adaptive_sync(struct wlr_randr_head *head);
+
+struct wlr_randr_mode *wlr_randr_head_next_mode(struct wlr_randr_head *head,
+	struct wlr_randr_mode *mode);
+void wlr_randr_mode_get_size(struct wlr_randr_mode *mode,
+	int32_t *width, int32_t *height);
+// In mHz, 0 if unknown
+int32_t wlr_randr_mode_get_refresh(struct wlr_randr_mode *mode);
+bool wlr_randr_mode_is_preferred(struct wlr_randr_mode *mode);
+
+/*
+ * Changes a head like the wlr-randr option of the same name does, e.g.
+ * ("mode", "1920x1080@60"), ("pos", "1920,0") or ("off", NULL). Changes are
+ * kept in the heads until applied or reset, a state received meanwhile
+ * overrides the properties it carries.
+ */
+bool wlr_randr_head_configure(struct wlr_randr_head *head,
+	const char *option, const char *value);
+/*
+ * Applies the changes, or only tests them, waiting at most timeout_ms for
+ * the compositor unless it is 0. Nothing is sent if the changes match the
+ * current state. Applied changes are cleared, failed ones are reset. Tested
+ * ones are kept for a later apply.
+ */
+enum wlr_randr_result wlr_randr_apply(struct wlr_randr *randr, bool test_only,
+	int timeout_ms);
+// Puts back the state the compositor last sent
+bool wlr_randr_reset(struct wlr_randr *randr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,313 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+#define JSON_MAX_DEPTH 32
+
+struct json_parser {
+	const char *cur;
+	const char *error;
+	int depth;
+};
+
+static void skip_whitespace(struct json_parser *parser) {
+	while (*parser->cur == ' ' || *parser->cur == '\t' ||
+			*parser->cur == '\n' || *parser->cur == '\r') {
+		parser->cur++;
+	}
+}
+
+static bool consume(struct json_parser *parser, const char *token) {
+	size_t len = strlen(token);
+	if (strncmp(parser->cur, token, len) != 0) {
+		return false;
+	}
+	parser->cur += len;
+	return true;
+}
+
+static void append_utf8(struct buffer *buf, uint32_t code) {
+	char bytes[4];
+	size_t len;
+	if (code < 0x80) {
+		bytes[0] = code;
+		len = 1;
+	} else if (code < 0x800) {
+		bytes[0] = 0xC0 | (code >> 6);
+		bytes[1] = 0x80 | (code & 0x3F);
+		len = 2;
+	} else if (code < 0x10000) {
+		bytes[0] = 0xE0 | (code >> 12);
+		bytes[1] = 0x80 | ((code >> 6) & 0x3F);
+		bytes[2] = 0x80 | (code & 0x3F);
+		len = 3;
+	} else {
+		bytes[0] = 0xF0 | (code >> 18);
+		bytes[1] = 0x80 | ((code >> 12) & 0x3F);
+		bytes[2] = 0x80 | ((code >> 6) & 0x3F);
+		bytes[3] = 0x80 | (code & 0x3F);
+		len = 4;
+	}
+	buffer_append(buf, bytes, len);
+}
+
+static bool parse_hex4(struct json_parser *parser, uint32_t *code) {
+	*code = 0;
+	for (int i = 0; i < 4; i++) {
+		char ch = parser->cur[i];
+		*code <<= 4;
+		if (ch >= '0' && ch <= '9') {
+			*code |= ch - '0';
+		} else if (ch >= 'a' && ch <= 'f') {
+			*code |= ch - 'a' + 10;
+		} else if (ch >= 'A' && ch <= 'F') {
+			*code |= ch - 'A' + 10;
+		} else {
+			return false;
+		}
+	}
+	parser->cur += 4;
+	return true;
+}
+
+static char *parse_string(struct json_parser *parser) {
+	if (*parser->cur != '"') {
+		parser->error = "expected string";
+		return NULL;
+	}
+	parser->cur++;
+
+	struct buffer buf = {0};
+	while (*parser->cur != '"') {
+		const char *run = parser->cur;
+		while (*parser->cur != '"' && *parser->cur != '\\' &&
+				(unsigned char)*parser->cur >= 0x20) {
+			parser->cur++;
+		}
+		buffer_append(&buf, run, parser->cur - run);
+
+		if (*parser->cur == '"') {
+			break;
+		} else if (*parser->cur != '\\') {
+			parser->error = "unterminated string";
+			goto error;
+		}
+
+		parser->cur++;
+		char ch = *parser->cur++;
+		switch (ch) {
+		case '"':
+		case '\\':
+		case '/':
+			buffer_append(&buf, &ch, 1);
+			break;
+		case 'b':
+			buffer_append(&buf, "\b", 1);
+			break;
+		case 'f':
+			buffer_append(&buf, "\f", 1);
+			break;
+		case 'n':
+			buffer_append(&buf, "\n", 1);
+			break;
+		case 'r':
+			buffer_append(&buf, "\r", 1);
+			break;
+		case 't':
+			buffer_append(&buf, "\t", 1);
+			break;
+		case 'u':;
+			uint32_t code;
+			if (!parse_hex4(parser, &code)) {
+				parser->error = "invalid unicode escape";
+				goto error;
+			}
+			if (code >= 0xD800 && code < 0xDC00 &&
+					parser->cur[0] == '\\' && parser->cur[1] == 'u') {
+				parser->cur += 2;
+				uint32_t low;
+				if (!parse_hex4(parser, &low) ||
+						low < 0xDC00 || low >= 0xE000) {
+					parser->error = "invalid unicode surrogate pair";
+					goto error;
+				}
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			}
+			append_utf8(&buf, code);
+			break;
+		default:
+			parser->error = "invalid escape sequence";
+			goto error;
+		}
+	}
+	parser->cur++;
+
+	buffer_append(&buf, "", 1);
+	if (buf.failed) {
+		parser->error = "out of memory";
+		goto error;
+	}
+	return buf.data;
+
+error:
+	buffer_finish(&buf);
+	return NULL;
+}
+
+static bool parse_value(struct json_parser *parser, struct json_value *value);
+
+static bool parse_container(struct json_parser *parser,
+		struct json_value *value, bool object) {
+	char end = object ? '}' : ']';
+	parser->cur++;
+	skip_whitespace(parser);
+	if (*parser->cur == end) {
+		parser->cur++;
+		return true;
+	}
+
+	while (1) {
+		char *key = NULL;
+		if (object) {
+			key = parse_string(parser);
+			if (key == NULL) {
+				return false;
+			}
+			skip_whitespace(parser);
+			if (!consume(parser, ":")) {
+				free(key);
+				parser->error = "expected ':'";
+				return false;
+			}
+		}
+
+		struct json_value *items = realloc(value->items,
+			(value->len + 1) * sizeof(*items));
+		char **keys = object ?
+			realloc(value->keys, (value->len + 1) * sizeof(*keys)) : NULL;
+		if (items != NULL) {
+			value->items = items;
+		}
+		if (keys != NULL) {
+			value->keys = keys;
+		}
+		if (items == NULL || (object && keys == NULL)) {
+			free(key);
+			parser->error = "out of memory";
+			return false;
+		}
+		if (object) {
+			value->keys[value->len] = key;
+		}
+		struct json_value *item = &value->items[value->len++];
+		*item = (struct json_value){0};
+
+		if (!parse_value(parser, item)) {
+			return false;
+		}
+
+		skip_whitespace(parser);
+		if (consume(parser, ",")) {
+			skip_whitespace(parser);
+			continue;
+		} else if (*parser->cur == end) {
+			parser->cur++;
+			return true;
+		}
+		parser->error = object ? "expected ',' or '}'" : "expected ',' or ']'";
+		return false;
+	}
+}
+
+static bool parse_value(struct json_parser *parser, struct json_value *value) {
+	skip_whitespace(parser);
+	switch (*parser->cur) {
+	case '{':
+	case '[':
+		if (++parser->depth > JSON_MAX_DEPTH) {
+			parser->error = "nested too deeply";
+			return false;
+		}
+		value->type = *parser->cur == '{' ? JSON_OBJECT : JSON_ARRAY;
+		if (!parse_container(parser, value, value->type == JSON_OBJECT)) {
+			return false;
+		}
+		parser->depth--;
+		return true;
+	case '"':
+		value->type = JSON_STRING;
+		value->string = parse_string(parser);
+		return value->string != NULL;
+	case 't':
+	case 'f':
+		value->type = JSON_BOOL;
+		value->boolean = *parser->cur == 't';
+		if (!consume(parser, value->boolean ? "true" : "false")) {
+			parser->error = "invalid literal";
+			return false;
+		}
+		return true;
+	case 'n':
+		value->type = JSON_NULL;
+		if (!consume(parser, "null")) {
+			parser->error = "invalid literal";
+			return false;
+		}
+		return true;
+	default:;
+		char *end;
+		value->type = JSON_NUMBER;
+		value->number = strtod(parser->cur, &end);
+		if (end == parser->cur) {
+			parser->error = "unexpected character";
+			return false;
+		}
+		parser->cur = end;
+		return true;
+	}
+}
+
+void json_finish(struct json_value *value) {
+	for (size_t i = 0; i < value->len; i++) {
+		json_finish(&value->items[i]);
+		if (value->keys != NULL) {
+			free(value->keys[i]);
+		}
+	}
+	free(value->items);
+	free(value->keys);
+	free(value->string);
+	*value = (struct json_value){0};
+}
+
+bool json_parse(struct json_value *value, const char *text,
+		size_t *error_offset, const char **error) {
+	struct json_parser parser = { .cur = text };
+	*value = (struct json_value){0};
+	if (parse_value(&parser, value)) {
+		skip_whitespace(&parser);
+		if (*parser.cur == '\0') {
+			return true;
+		}
+		parser.error = "trailing characters";
+	}
+
+	*error_offset = parser.cur - text;
+	*error = parser.error;
+	json_finish(value);
+	return false;
+}
+
+const struct json_value *json_object_get(const struct json_value *object,
+		const char *key) {
+	if (object->type != JSON_OBJECT) {
+		return NULL;
+	}
+	for (size_t i = 0; i < object->len; i++) {
+		if (strcmp(object->keys[i], key) == 0) {
+			return &object->items[i];
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+static bool read_file(const char *path, struct buffer *buf) {
+	FILE *f = stdin;
+	if (strcmp(path, "-") != 0) {
+		f = fopen(path, "r");
+		if (f == NULL) {
+			log_error("failed to open %s: %s\n", path, strerror(errno));
+			return false;
+		}
+	}
+
+	char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		buffer_append(buf, chunk, n);
+	}
+	bool ok = !ferror(f);
+	if (f != stdin) {
+		fclose(f);
+	}
+	buffer_append(buf, "", 1);
+
+	if (!ok) {
+		log_error("failed to read %s\n", path);
+		return false;
+	} else if (buf->failed) {
+		log_error("failed to allocate buffer for %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * One or more whitespace-separated options per line, spelled like on the
+ * command line with or without the leading dashes:
+ *
+ *     # comment
+ *     output DP-1 mode 1920x1080@60 pos 0,0
+ *     output HDMI-A-1
+ *       off
+ */
+static bool parse_layout_lines(struct randr_state *state, char *text,
+		const char *path, bool *changed) {
+	static const char delim[] = " \t\r";
+	struct randr_head *head = NULL;
+	int lineno = 0;
+	char *next;
+	for (char *line = text; line != NULL; line = next) {
+		lineno++;
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		char *comment = strchr(line, '#');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+
+		char *saveptr;
+		char *token = strtok_r(line, delim, &saveptr);
+		for (; token != NULL; token = strtok_r(NULL, delim, &saveptr)) {
+			const char *name = token;
+			if (strncmp(name, "--", 2) == 0) {
+				name += 2;
+			}
+
+			const char *value = NULL;
+			if (strcmp(name, "output") == 0 ||
+					output_option_takes_value(name)) {
+				value = strtok_r(NULL, delim, &saveptr);
+				if (value == NULL) {
+					log_error("%s:%d: missing value for %s\n",
+						path, lineno, name);
+					return false;
+				}
+			}
+
+			if (strcmp(name, "output") == 0) {
+				head = find_head(state, value);
+				if (head == NULL) {
+					log_error("%s:%d: unknown output %s\n",
+						path, lineno, value);
+					return false;
+				}
+				continue;
+			}
+
+			if (head == NULL) {
+				log_error("%s:%d: no output specified before %s\n",
+					path, lineno, name);
+				return false;
+			}
+			if (!parse_output_arg(head, name, value)) {
+				log_error("%s:%d: failed to set %s\n", path, lineno, name);
+				return false;
+			}
+			*changed = true;
+		}
+	}
+
+	return true;
+}
+
+static bool get_json_int(const struct json_value *object, const char *key,
+		int32_t *out) {
+	const struct json_value *value = json_object_get(object, key);
+	if (value == NULL || value->type != JSON_NUMBER) {
+		return false;
+	}
+	*out = lround(value->number);
+	return true;
+}
+
+static const struct json_value *get_json_mode(const struct json_value *entry) {
+	const struct json_value *mode = json_object_get(entry, "mode");
+	if (mode != NULL && mode->type == JSON_OBJECT) {
+		return mode;
+	}
+
+	// As printed by --json
+	const struct json_value *modes = json_object_get(entry, "modes");
+	if (modes == NULL || modes->type != JSON_ARRAY) {
+		return NULL;
+	}
+	for (size_t i = 0; i < modes->len; i++) {
+		const struct json_value *current =
+			json_object_get(&modes->items[i], "current");
+		if (current != NULL && current->type == JSON_BOOL &&
+				current->boolean) {
+			return &modes->items[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Entries follow the --json output: only "name", "enabled", the current
+ * mode, "position", "transform", "scale" and "adaptive_sync" are used. The
+ * mode may also be given directly as a "mode" object. The json-compact
+ * output is accepted as well, with "refresh_mhz" and "scale_fixed" instead
+ * of "refresh" and "scale".
+ */
+static bool parse_layout_json_entry(struct randr_state *state,
+		const struct json_value *entry, const char *path, size_t index,
+		bool *changed) {
+	const struct json_value *name = json_object_get(entry, "name");
+	if (name == NULL || name->type != JSON_STRING) {
+		log_error("%s: entry %zu: missing output name\n", path, index);
+		return false;
+	}
+	struct randr_head *head = find_head(state, name->string);
+	if (head == NULL) {
+		log_error("%s: entry %zu: unknown output %s\n", path, index,
+			name->string);
+		return false;
+	}
+
+	struct {
+		const char *name;
+		char value[64];
+	} args[8];
+	size_t args_len = 0;
+
+	const struct json_value *enabled = json_object_get(entry, "enabled");
+	if (enabled != NULL && enabled->type == JSON_BOOL) {
+		args[args_len].name = enabled->boolean ? "on" : "off";
+		args[args_len++].value[0] = '\0';
+		if (!enabled->boolean) {
+			goto apply;
+		}
+	}
+
+	const struct json_value *mode = get_json_mode(entry);
+	int32_t width, height;
+	if (mode != NULL && get_json_int(mode, "width", &width) &&
+			get_json_int(mode, "height", &height)) {
+		const struct json_value *refresh = json_object_get(mode, "refresh");
+		int32_t refresh_mhz;
+		args[args_len].name = "mode";
+		if (refresh != NULL && refresh->type == JSON_NUMBER &&
+				refresh->number > 0) {
+			snprintf(args[args_len++].value, sizeof(args[0].value),
+				"%dx%d@%.3f", width, height, refresh->number);
+		} else if (get_json_int(mode, "refresh_mhz", &refresh_mhz) &&
+				refresh_mhz > 0) {
+			snprintf(args[args_len++].value, sizeof(args[0].value),
+				"%dx%d@%.3f", width, height, refresh_mhz / 1000.0);
+		} else {
+			snprintf(args[args_len++].value, sizeof(args[0].value),
+				"%dx%d", width, height);
+		}
+	}
+
+	const struct json_value *position = json_object_get(entry, "position");
+	int32_t x, y;
+	if (position != NULL && get_json_int(position, "x", &x) &&
+			get_json_int(position, "y", &y)) {
+		args[args_len].name = "pos";
+		snprintf(args[args_len++].value, sizeof(args[0].value),
+			"%d,%d", x, y);
+	}
+
+	const struct json_value *transform = json_object_get(entry, "transform");
+	if (transform != NULL && transform->type == JSON_STRING) {
+		args[args_len].name = "transform";
+		snprintf(args[args_len++].value, sizeof(args[0].value),
+			"%s", transform->string);
+	}
+
+	const struct json_value *scale = json_object_get(entry, "scale");
+	int32_t scale_fixed;
+	if (scale != NULL && scale->type == JSON_NUMBER) {
+		args[args_len].name = "scale";
+		snprintf(args[args_len++].value, sizeof(args[0].value),
+			"%.9g", scale->number);
+	} else if (get_json_int(entry, "scale_fixed", &scale_fixed)) {
+		args[args_len].name = "scale";
+		snprintf(args[args_len++].value, sizeof(args[0].value),
+			"%.9g", wl_fixed_to_double(scale_fixed));
+	}
+
+	const struct json_value *adaptive_sync =
+		json_object_get(entry, "adaptive_sync");
+	if (adaptive_sync != NULL && adaptive_sync->type == JSON_BOOL) {
+		args[args_len].name = "adaptive-sync";
+		snprintf(args[args_len++].value, sizeof(args[0].value), "%s",
+			adaptive_sync->boolean ? "enabled" : "disabled");
+	}
+
+apply:
+	for (size_t i = 0; i < args_len; i++) {
+		if (!parse_output_arg(head, args[i].name, args[i].value)) {
+			log_error("%s: entry %zu: failed to set %s\n", path, index,
+				args[i].name);
+			return false;
+		}
+		*changed = true;
+	}
+	return true;
+}
+
+static bool parse_layout_json(struct randr_state *state, const char *text,
+		const char *path, bool *changed) {
+	struct json_value root;
+	size_t error_offset;
+	const char *error;
+	if (!json_parse(&root, text, &error_offset, &error)) {
+		int lineno = 1;
+		for (size_t i = 0; i < error_offset; i++) {
+			lineno += text[i] == '\n';
+		}
+		log_error("%s:%d: invalid JSON: %s\n", path, lineno, error);
+		return false;
+	}
+
+	bool ok = true;
+	if (root.type == JSON_OBJECT) {
+		ok = parse_layout_json_entry(state, &root, path, 0, changed);
+	} else if (root.type == JSON_ARRAY) {
+		for (size_t i = 0; ok && i < root.len; i++) {
+			ok = parse_layout_json_entry(state, &root.items[i], path, i,
+				changed);
+		}
+	} else {
+		log_error("%s: expected an array of outputs\n", path);
+		ok = false;
+	}
+
+	json_finish(&root);
+	return ok;
+}
+
+bool parse_layout_file(struct randr_state *state, const char *path,
+		bool *changed) {
+	struct buffer buf = {0};
+	if (!read_file(path, &buf)) {
+		buffer_finish(&buf);
+		return false;
+	}
+
+	const char *display_path = strcmp(path, "-") == 0 ? "<stdin>" : path;
+	const char *start = buf.data + strspn(buf.data, " \t\r\n");
+	bool ok;
+	if (start[0] == '[' || start[0] == '{') {
+		ok = parse_layout_json(state, buf.data, display_path, changed);
+	} else {
+		ok = parse_layout_lines(state, buf.data, display_path, changed);
+	}
+
+	buffer_finish(&buf);
+	return ok;
+}
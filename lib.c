@@ -0,0 +1,335 @@
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client.h>
+#include "randr.h"
+#include "wlr-randr.h"
+
+/*
+ * The public API of libwlr-randr, a thin layer over the code the command
+ * uses. Public types are the internal ones under another name, and only the
+ * functions marked with EXPORT are visible outside the library.
+ */
+
+#define EXPORT __attribute__((visibility("default")))
+
+struct wlr_randr {
+	struct randr_state state;
+	struct wl_display *display;
+	struct wl_registry *registry;
+
+	// Taken before the first change since the last apply or reset
+	struct layout_snapshot original;
+	bool pending;
+
+	const struct wlr_randr_listener *listener;
+	void *listener_data;
+};
+
+static struct randr_head *get_head(struct wlr_randr_head *head) {
+	return (struct randr_head *)head;
+}
+
+static struct randr_mode *get_mode(struct wlr_randr_mode *mode) {
+	return (struct randr_mode *)mode;
+}
+
+static void state_handle_done(void *data, struct randr_state *state) {
+	struct wlr_randr *randr = data;
+	if (randr->listener != NULL && randr->listener->done != NULL) {
+		randr->listener->done(randr->listener_data, randr);
+	}
+}
+
+static void state_handle_head_finished(void *data, struct randr_head *head) {
+	struct wlr_randr *randr = data;
+	if (randr->listener != NULL && randr->listener->head_removed != NULL) {
+		randr->listener->head_removed(randr->listener_data,
+			(struct wlr_randr_head *)head);
+	}
+}
+
+static const struct randr_state_listener state_listener = {
+	.done = state_handle_done,
+	.head_finished = state_handle_head_finished,
+};
+
+EXPORT void wlr_randr_disconnect(struct wlr_randr *randr) {
+	if (randr == NULL) {
+		return;
+	}
+	finish_layout_snapshot(&randr->original);
+	// Heads only come from the output manager
+	if (randr->state.output_manager != NULL) {
+		destroy_state(&randr->state);
+	} else {
+		wl_array_release(&randr->state.output_globals);
+	}
+	if (randr->registry != NULL) {
+		wl_registry_destroy(randr->registry);
+	}
+	wl_display_disconnect(randr->display);
+	free(randr);
+}
+
+EXPORT struct wlr_randr *wlr_randr_connect(const char *display_name,
+		int timeout_ms) {
+	struct wlr_randr *randr = calloc(1, sizeof(*randr));
+	if (randr == NULL) {
+		fprintf(stderr, "failed to allocate state\n");
+		return NULL;
+	}
+	wl_list_init(&randr->state.heads);
+
+	double deadline = deadline_after(timeout_ms);
+	randr->display = wl_display_connect(display_name);
+	if (randr->display == NULL) {
+		fprintf(stderr, "failed to connect to display\n");
+		free(randr);
+		return NULL;
+	}
+	if (enumerate_state(&randr->state, randr->display, deadline,
+			&randr->registry) != EXIT_SUCCESS) {
+		wlr_randr_disconnect(randr);
+		return NULL;
+	}
+
+	randr->state.listener = &state_listener;
+	randr->state.listener_data = randr;
+	return randr;
+}
+
+EXPORT int wlr_randr_get_fd(struct wlr_randr *randr) {
+	return wl_display_get_fd(randr->display);
+}
+
+EXPORT enum wlr_randr_result wlr_randr_dispatch(struct wlr_randr *randr,
+		int timeout_ms) {
+	double deadline = timeout_ms < 0 ? -1 : timings_now() + timeout_ms / 1e3;
+	struct pollfd fds[1];
+	int ret = poll_display(randr->display, fds, 1, deadline);
+	if (ret < 0) {
+		return WLR_RANDR_FAILED;
+	}
+	return ret > 0 ? WLR_RANDR_SUCCESS : WLR_RANDR_TIMEOUT;
+}
+
+EXPORT void wlr_randr_set_listener(struct wlr_randr *randr,
+		const struct wlr_randr_listener *listener, void *data) {
+	randr->listener = listener;
+	randr->listener_data = data;
+}
+
+EXPORT uint32_t wlr_randr_get_serial(struct wlr_randr *randr) {
+	return randr->state.serial;
+}
+
+EXPORT bool wlr_randr_encode(struct wlr_randr *randr,
+		enum wlr_randr_format format, char **data, size_t *len) {
+	enum randr_format randr_format;
+	switch (format) {
+	case WLR_RANDR_FORMAT_TEXT:
+		randr_format = RANDR_FORMAT_TEXT;
+		break;
+	case WLR_RANDR_FORMAT_JSON:
+		randr_format = RANDR_FORMAT_JSON;
+		break;
+	case WLR_RANDR_FORMAT_JSON_COMPACT:
+		randr_format = RANDR_FORMAT_JSON_COMPACT;
+		break;
+	case WLR_RANDR_FORMAT_CBOR:
+		randr_format = RANDR_FORMAT_CBOR;
+		break;
+	case WLR_RANDR_FORMAT_MSGPACK:
+		randr_format = RANDR_FORMAT_MSGPACK;
+		break;
+	default:
+		fprintf(stderr, "invalid format: %d\n", format);
+		return false;
+	}
+
+	struct buffer buf = {0};
+	print_state_format(&randr->state, randr_format, NULL, &buf);
+	if (buf.failed) {
+		fprintf(stderr, "failed to allocate output\n");
+		buffer_finish(&buf);
+		return false;
+	}
+	*data = buf.data;
+	*len = buf.len;
+	return true;
+}
+
+EXPORT struct wlr_randr_head *wlr_randr_next_head(struct wlr_randr *randr,
+		struct wlr_randr_head *head) {
+	struct wl_list *link = head != NULL ?
+		get_head(head)->link.next : randr->state.heads.next;
+	if (link == &randr->state.heads) {
+		return NULL;
+	}
+	struct randr_head *next = wl_container_of(link, next, link);
+	return (struct wlr_randr_head *)next;
+}
+
+EXPORT struct wlr_randr_head *wlr_randr_find_head(struct wlr_randr *randr,
+		const char *name) {
+	return (struct wlr_randr_head *)find_head(&randr->state, name);
+}
+
+EXPORT const char *wlr_randr_head_get_name(struct wlr_randr_head *head) {
+	return get_head(head)->name;
+}
+
+EXPORT const char *wlr_randr_head_get_description(
+		struct wlr_randr_head *head) {
+	return get_head(head)->description;
+}
+
+EXPORT const char *wlr_randr_head_get_make(struct wlr_randr_head *head) {
+	return get_head(head)->make;
+}
+
+EXPORT const char *wlr_randr_head_get_model(struct wlr_randr_head *head) {
+	return get_head(head)->model;
+}
+
+EXPORT const char *wlr_randr_head_get_serial_number(
+		struct wlr_randr_head *head) {
+	return get_head(head)->serial_number;
+}
+
+EXPORT void wlr_randr_head_get_physical_size(struct wlr_randr_head *head,
+		int32_t *width, int32_t *height) {
+	*width = get_head(head)->phys_width;
+	*height = get_head(head)->phys_height;
+}
+
+EXPORT bool wlr_randr_head_get_enabled(struct wlr_randr_head *head) {
+	return get_head(head)->enabled;
+}
+
+EXPORT struct wlr_randr_mode *wlr_randr_head_get_mode(
+		struct wlr_randr_head *head) {
+	if (!get_head(head)->enabled) {
+		return NULL;
+	}
+	return (struct wlr_randr_mode *)get_head(head)->mode;
+}
+
+EXPORT void wlr_randr_head_get_position(struct wlr_randr_head *head,
+		int32_t *x, int32_t *y) {
+	*x = get_head(head)->x;
+	*y = get_head(head)->y;
+}
+
+EXPORT int32_t wlr_randr_head_get_transform(struct wlr_randr_head *head) {
+	return get_head(head)->transform;
+}
+
+EXPORT double wlr_randr_head_get_scale(struct wlr_randr_head *head) {
+	return get_head(head)->scale;
+}
+
+EXPORT bool wlr_randr_head_get_adaptive_sync(struct wlr_randr_head *head) {
+	return get_head(head)->adaptive_sync_state ==
+		ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED;
+}
+
+EXPORT struct wlr_randr_mode *wlr_randr_head_next_mode(
+		struct wlr_randr_head *head, struct wlr_randr_mode *mode) {
+	struct randr_head *randr_head = get_head(head);
+	struct wl_list *link = mode != NULL ?
+		get_mode(mode)->link.next : randr_head->modes.next;
+	if (link == &randr_head->modes) {
+		return NULL;
+	}
+	struct randr_mode *next = wl_container_of(link, next, link);
+	return (struct wlr_randr_mode *)next;
+}
+
+EXPORT void wlr_randr_mode_get_size(struct wlr_randr_mode *mode,
+		int32_t *width, int32_t *height) {
+	*width = get_mode(mode)->width;
+	*height = get_mode(mode)->height;
+}
+
+EXPORT int32_t wlr_randr_mode_get_refresh(struct wlr_randr_mode *mode) {
+	return get_mode(mode)->refresh;
+}
+
+EXPORT bool wlr_randr_mode_is_preferred(struct wlr_randr_mode *mode) {
+	return get_mode(mode)->preferred;
+}
+
+EXPORT bool wlr_randr_head_configure(struct wlr_randr_head *head,
+		const char *option, const char *value) {
+	struct randr_head *randr_head = get_head(head);
+	struct wlr_randr *randr = wl_container_of(randr_head->state, randr, state);
+
+	// Unknown options are rejected by parse_output_arg()
+	if (output_option_takes_value(option) && value == NULL) {
+		log_error("option %s requires a value\n", option);
+		return false;
+	}
+
+	if (!randr->pending) {
+		if (!take_layout_snapshot(&randr->state, &randr->original)) {
+			return false;
+		}
+		randr->pending = true;
+	}
+	return parse_output_arg(randr_head, option, value);
+}
+
+static void clear_changes(struct wlr_randr *randr) {
+	finish_layout_snapshot(&randr->original);
+	randr->pending = false;
+
+	struct randr_head *head;
+	wl_list_for_each(head, &randr->state.heads, link) {
+		head->changed = 0;
+	}
+}
+
+EXPORT bool wlr_randr_reset(struct wlr_randr *randr) {
+	if (!randr->pending) {
+		return true;
+	}
+	bool ok = restore_layout_snapshot(&randr->state, &randr->original, true);
+	clear_changes(randr);
+	return ok;
+}
+
+EXPORT enum wlr_randr_result wlr_randr_apply(struct wlr_randr *randr,
+		bool test_only, int timeout_ms) {
+	if (!randr->pending) {
+		return WLR_RANDR_SUCCESS;
+	}
+
+	int exit_code = EXIT_FAILURE;
+	if (check_layout(&randr->state)) {
+		struct randr_command cmd = {
+			.changed = true,
+			.dry_run = test_only,
+			.no_op_skip = true,
+			.apply_timeout = timeout_ms,
+		};
+		exit_code = run_transaction(&randr->state, randr->display,
+			&randr->original, &cmd);
+	}
+
+	if (exit_code != EXIT_SUCCESS) {
+		// The compositor still has the previous state
+		wlr_randr_reset(randr);
+	} else if (!test_only) {
+		// The new state has been received
+		clear_changes(randr);
+	}
+
+	if (exit_code == EXIT_SUCCESS) {
+		return WLR_RANDR_SUCCESS;
+	}
+	return exit_code == EXIT_TIMEOUT ? WLR_RANDR_TIMEOUT : WLR_RANDR_FAILED;
+}
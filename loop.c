@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-client.h>
+#include "randr.h"
+
+/*
+ * Waiting on the compositor goes through poll() instead of blocking in
+ * wl_display_dispatch(), so that it can be bounded by a deadline and
+ * combined with other file descriptors. Deadlines are absolute times as
+ * returned by timings_now(), or negative for none.
+ */
+
+double deadline_after(int timeout_ms) {
+	return timeout_ms > 0 ? timings_now() + timeout_ms / 1e3 : -1;
+}
+
+static int remaining_ms(double deadline) {
+	if (deadline < 0) {
+		return -1;
+	}
+	double remaining = (deadline - timings_now()) * 1e3;
+	if (remaining <= 0) {
+		return 0;
+	}
+	// Round up, waking up right before the deadline would only spin
+	return remaining >= INT_MAX ? INT_MAX : (int)remaining + 1;
+}
+
+/*
+ * Reads and dispatches events, waiting at most until the deadline. The first
+ * entry of fds is filled in for the display, the others are polled along
+ * with it and their revents are left for the caller to check. Returns 1 if
+ * anything happened, 0 if nothing did before the deadline or a signal, and
+ * -1 on error.
+ */
+int poll_display(struct wl_display *display, struct pollfd *fds,
+		size_t fds_len, double deadline) {
+	if (wl_display_prepare_read(display) != 0) {
+		// Queued events may be all the caller is waiting for
+		if (wl_display_dispatch_pending(display) < 0) {
+			fprintf(stderr, "wl_display_dispatch_pending failed\n");
+			return -1;
+		}
+		return 1;
+	}
+
+	short events = POLLIN;
+	if (wl_display_flush(display) < 0) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			fprintf(stderr, "wl_display_flush failed\n");
+			return -1;
+		}
+		// The socket is full, flush the rest once it isn't anymore
+		events |= POLLOUT;
+	}
+
+	fds[0] = (struct pollfd){
+		.fd = wl_display_get_fd(display),
+		.events = events,
+	};
+	int n = poll(fds, fds_len, remaining_ms(deadline));
+	if (n < 0) {
+		wl_display_cancel_read(display);
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("poll");
+		return -1;
+	}
+
+	if (fds[0].revents & POLLIN) {
+		if (wl_display_read_events(display) < 0) {
+			fprintf(stderr, "wl_display_read_events failed\n");
+			return -1;
+		}
+	} else {
+		wl_display_cancel_read(display);
+		if (fds[0].revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "lost connection to the compositor\n");
+			return -1;
+		}
+	}
+	if (wl_display_dispatch_pending(display) < 0) {
+		fprintf(stderr, "wl_display_dispatch_pending failed\n");
+		return -1;
+	}
+	return n > 0;
+}
+
+enum dispatch_result dispatch_until(struct wl_display *display,
+		double deadline, bool (*done)(void *data), void *data) {
+	while (!done(data)) {
+		if (deadline >= 0 && timings_now() >= deadline) {
+			return DISPATCH_TIMEOUT;
+		}
+		struct pollfd fds[1];
+		if (poll_display(display, fds, 1, deadline) < 0) {
+			return DISPATCH_FAILED;
+		}
+	}
+	return DISPATCH_DONE;
+}
+
+static void sync_handle_done(void *data, struct wl_callback *callback,
+		uint32_t serial) {
+	bool *done = data;
+	*done = true;
+}
+
+static const struct wl_callback_listener sync_listener = {
+	.done = sync_handle_done,
+};
+
+static bool is_set(void *data) {
+	return *(bool *)data;
+}
+
+enum dispatch_result roundtrip_until(struct wl_display *display,
+		double deadline) {
+	bool done = false;
+	struct wl_callback *callback = wl_display_sync(display);
+	if (callback == NULL) {
+		fprintf(stderr, "wl_display_sync failed\n");
+		return DISPATCH_FAILED;
+	}
+	wl_callback_add_listener(callback, &sync_listener, &done);
+	enum dispatch_result result =
+		dispatch_until(display, deadline, is_set, &done);
+	wl_callback_destroy(callback);
+	return result;
+}
+
+int dispatch_exit_code(enum dispatch_result result) {
+	switch (result) {
+	case DISPATCH_DONE:
+		return EXIT_SUCCESS;
+	case DISPATCH_TIMEOUT:
+		fprintf(stderr, "timed out waiting for the compositor\n");
+		return EXIT_TIMEOUT;
+	case DISPATCH_FAILED:
+		break;
+	}
+	return EXIT_FAILURE;
+}
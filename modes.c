@@ -0,0 +1,380 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Modes are selected from a per-head table sorted by resolution (area, then
+ * width and height) and refresh rate, so that the largest mode, the fastest
+ * refresh rate of a resolution, the rate closest to a requested one or an
+ * exact mode are found with a binary search. Entries are packed copies of
+ * the modes, 16 bytes each, so that searches don't chase pointers: the
+ * records are only looked up for the result, by index. The table is rebuilt
+ * once the compositor is done sending changes, or on the next lookup.
+ */
+
+// Refresh rates are printed and parsed in Hz, allow for rounding
+#define REFRESH_TOLERANCE 10 // mHz
+// For ~<refresh>, e.g. ~60 to pick 59.940 Hz if there is no 60.000 Hz mode
+#define NEAREST_REFRESH_TOLERANCE 1000 // mHz
+
+static int compare_size(int32_t width_a, int32_t height_a,
+		int32_t width_b, int32_t height_b) {
+	int64_t area_a = (int64_t)width_a * height_a;
+	int64_t area_b = (int64_t)width_b * height_b;
+	if (area_a != area_b) {
+		return area_a < area_b ? -1 : 1;
+	}
+	if (width_a != width_b) {
+		return width_a < width_b ? -1 : 1;
+	}
+	if (height_a != height_b) {
+		return height_a < height_b ? -1 : 1;
+	}
+	return 0;
+}
+
+// Orders by size, refresh rate and then advertisement order
+static int compare_modes(const void *a, const void *b) {
+	const struct randr_mode_entry *entry_a = a, *entry_b = b;
+	int cmp = compare_size(entry_a->width, entry_a->height,
+		entry_b->width, entry_b->height);
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (entry_a->refresh != entry_b->refresh) {
+		return entry_a->refresh < entry_b->refresh ? -1 : 1;
+	}
+	return entry_a->index < entry_b->index ? -1 :
+		entry_a->index > entry_b->index;
+}
+
+static bool is_sorted(const struct randr_mode_entry *entries, size_t len,
+		int order) {
+	for (size_t i = 1; i < len; i++) {
+		if (compare_modes(&entries[i - 1], &entries[i]) * order > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compositors usually advertise modes in order, often the largest first
+static void sort_entries(struct randr_mode_entry *entries, size_t len) {
+	if (!is_sorted(entries, len, -1)) {
+		qsort(entries, len, sizeof(*entries), compare_modes);
+		return;
+	}
+	for (size_t i = 0; i < len / 2; i++) {
+		struct randr_mode_entry entry = entries[i];
+		entries[i] = entries[len - 1 - i];
+		entries[len - 1 - i] = entry;
+	}
+}
+
+void invalidate_sorted_modes(struct randr_head *head) {
+	head->sorted_modes_valid = false;
+}
+
+bool sort_modes(struct randr_head *head) {
+	if (head->sorted_modes_valid) {
+		return true;
+	}
+
+	size_t len = wl_list_length(&head->modes);
+	if (len > head->sorted_modes_cap) {
+		struct randr_mode_entry *entries = realloc(head->sorted_modes,
+			len * sizeof(*entries));
+		if (entries != NULL) {
+			head->sorted_modes = entries;
+		}
+		struct randr_mode **records = realloc(head->mode_records,
+			len * sizeof(*records));
+		if (records != NULL) {
+			head->mode_records = records;
+		}
+		if (entries == NULL || records == NULL) {
+			log_error("failed to allocate mode table\n");
+			return false;
+		}
+		head->sorted_modes_cap = len;
+	}
+
+	// The list is in advertisement order
+	size_t i = 0;
+	struct randr_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		head->mode_records[i] = mode;
+		head->sorted_modes[i] = (struct randr_mode_entry){
+			.width = mode->width,
+			.height = mode->height,
+			.refresh = mode->refresh,
+			.index = i,
+		};
+		i++;
+	}
+	if (!is_sorted(head->sorted_modes, len, 1)) {
+		sort_entries(head->sorted_modes, len);
+	}
+	head->sorted_modes_len = len;
+	head->sorted_modes_valid = true;
+	return true;
+}
+
+void finish_sorted_modes(struct randr_head *head) {
+	free(head->sorted_modes);
+	free(head->mode_records);
+	head->sorted_modes = NULL;
+	head->mode_records = NULL;
+	head->sorted_modes_len = head->sorted_modes_cap = 0;
+	head->sorted_modes_valid = false;
+}
+
+static struct randr_mode *entry_mode(const struct randr_head *head,
+		const struct randr_mode_entry *entry) {
+	return head->mode_records[entry->index];
+}
+
+// Index of the first mode not before width x height at the refresh rate
+static size_t lower_bound(const struct randr_head *head,
+		int32_t width, int32_t height, int32_t refresh) {
+	size_t lo = 0, hi = head->sorted_modes_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct randr_mode_entry *entry = &head->sorted_modes[mid];
+		int cmp = compare_size(entry->width, entry->height, width, height);
+		if (cmp < 0 || (cmp == 0 && entry->refresh < refresh)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static bool has_size(const struct randr_mode_entry *entry,
+		int32_t width, int32_t height) {
+	return entry->width == width && entry->height == height;
+}
+
+// The first advertised one, compositors list their favorite rates first
+static struct randr_mode *select_any_refresh(struct randr_head *head,
+		int32_t width, int32_t height) {
+	const struct randr_mode_entry *found = NULL;
+	for (size_t i = lower_bound(head, width, height, INT32_MIN);
+			i < head->sorted_modes_len &&
+			has_size(&head->sorted_modes[i], width, height); i++) {
+		const struct randr_mode_entry *entry = &head->sorted_modes[i];
+		if (found == NULL || entry->index < found->index) {
+			found = entry;
+		}
+	}
+	return found != NULL ? entry_mode(head, found) : NULL;
+}
+
+static struct randr_mode *select_max_refresh(struct randr_head *head,
+		int32_t width, int32_t height) {
+	size_t end = lower_bound(head, width, height, INT32_MAX);
+	if (end < head->sorted_modes_len &&
+			has_size(&head->sorted_modes[end], width, height)) {
+		// At INT32_MAX mHz
+		return entry_mode(head, &head->sorted_modes[end]);
+	} else if (end > 0 &&
+			has_size(&head->sorted_modes[end - 1], width, height)) {
+		return entry_mode(head, &head->sorted_modes[end - 1]);
+	}
+	return NULL;
+}
+
+static struct randr_mode *select_nearest_refresh(struct randr_head *head,
+		int32_t width, int32_t height, int32_t refresh, int32_t tolerance) {
+	const struct randr_mode_entry *best = NULL;
+	int64_t best_delta = 0;
+	for (size_t i = lower_bound(head, width, height, refresh - tolerance);
+			i < head->sorted_modes_len; i++) {
+		const struct randr_mode_entry *entry = &head->sorted_modes[i];
+		int64_t delta = (int64_t)entry->refresh - refresh;
+		if (!has_size(entry, width, height) || delta > tolerance) {
+			break;
+		}
+		// Ties go to the lower rate, which comes first
+		if (best == NULL || llabs(delta) < best_delta) {
+			best = entry;
+			best_delta = llabs(delta);
+		}
+	}
+	return best != NULL ? entry_mode(head, best) : NULL;
+}
+
+// Picks the first advertised mode if several match, like a list scan would
+struct randr_mode *find_mode(struct randr_head *head,
+		int32_t width, int32_t height, int32_t refresh) {
+	if (!sort_modes(head)) {
+		return NULL;
+	} else if (refresh == 0) {
+		return select_any_refresh(head, width, height);
+	}
+	// Equal entries are in advertisement order
+	size_t i = lower_bound(head, width, height, refresh);
+	if (i < head->sorted_modes_len &&
+			has_size(&head->sorted_modes[i], width, height) &&
+			head->sorted_modes[i].refresh == refresh) {
+		return entry_mode(head, &head->sorted_modes[i]);
+	}
+	return NULL;
+}
+
+struct randr_mode *select_mode(struct randr_head *head,
+		const struct mode_query *query) {
+	if (!sort_modes(head) || head->sorted_modes_len == 0) {
+		return NULL;
+	}
+
+	int32_t width = query->width, height = query->height;
+	if (query->size == MODE_SIZE_MAX) {
+		const struct randr_mode_entry *largest =
+			&head->sorted_modes[head->sorted_modes_len - 1];
+		width = largest->width;
+		height = largest->height;
+	} else if (query->size == MODE_SIZE_CURRENT) {
+		const struct randr_mode *current = head->mode;
+		if (current == NULL) {
+			current = default_mode(head);
+		}
+		if (current == NULL) {
+			return NULL;
+		}
+		width = current->width;
+		height = current->height;
+	}
+	switch (query->refresh_match) {
+	case MODE_REFRESH_ANY:
+		return select_any_refresh(head, width, height);
+	case MODE_REFRESH_MAX:
+		return select_max_refresh(head, width, height);
+	case MODE_REFRESH_EXACT:
+		return select_nearest_refresh(head, width, height, query->refresh,
+			REFRESH_TOLERANCE);
+	case MODE_REFRESH_NEAREST:
+		return select_nearest_refresh(head, width, height, query->refresh,
+			NEAREST_REFRESH_TOLERANCE);
+	}
+	return NULL;
+}
+
+struct randr_mode *preferred_mode(struct randr_head *head) {
+	struct randr_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->preferred) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+// The preferred mode, else the largest and fastest one
+struct randr_mode *default_mode(struct randr_head *head) {
+	struct randr_mode *mode = preferred_mode(head);
+	if (mode != NULL) {
+		return mode;
+	}
+	struct mode_query query = {
+		.size = MODE_SIZE_MAX,
+		.refresh_match = MODE_REFRESH_MAX,
+	};
+	return select_mode(head, &query);
+}
+
+static bool parse_refresh(const char *str, int32_t *refresh) {
+	char *end;
+	double refresh_hz = strtod(str, &end);
+	if ((end[0] != '\0' && strcmp(end, "Hz") != 0) || str == end ||
+			!(refresh_hz > 0) || refresh_hz * 1000 > INT32_MAX) {
+		return false;
+	}
+	*refresh = round(refresh_hz * 1000); // Hz → mHz
+	return true;
+}
+
+/*
+ * Accepts:
+ *
+ *     max
+ *     ~<refresh>[Hz]
+ *     <width>x<height>[ px][(,|@)<refresh>]
+ *
+ * with refresh one of max, ~<refresh>[Hz] or <refresh>[Hz]. ~ picks the
+ * closest rate within 1 Hz, at the current resolution if none is given.
+ */
+bool parse_mode_query(const char *value, struct mode_query *query) {
+	*query = (struct mode_query){0};
+	if (strcmp(value, "max") == 0) {
+		query->size = MODE_SIZE_MAX;
+		query->refresh_match = MODE_REFRESH_MAX;
+		return true;
+	} else if (value[0] == '~') {
+		query->size = MODE_SIZE_CURRENT;
+		query->refresh_match = MODE_REFRESH_NEAREST;
+		if (!parse_refresh(&value[1], &query->refresh)) {
+			log_error("invalid mode: invalid refresh rate: %s\n", value);
+			return false;
+		}
+		return true;
+	}
+
+	// width + "x" + height
+	const char *cur = value;
+	char *end;
+	long width = strtol(cur, &end, 10);
+	if (end[0] != 'x' || cur == end || width <= 0 || width > INT32_MAX) {
+		log_error("invalid mode: invalid width: %s\n", value);
+		return false;
+	}
+	cur = end + 1;
+	long height = strtol(cur, &end, 10);
+	if (cur == end || height <= 0 || height > INT32_MAX) {
+		log_error("invalid mode: invalid height: %s\n", value);
+		return false;
+	}
+	query->width = width;
+	query->height = height;
+
+	// whitespace + "px"
+	cur = end;
+	while (cur[0] == ' ') {
+		cur++;
+	}
+	if (strncmp(cur, "px", 2) == 0) {
+		cur += 2;
+	}
+	if (cur[0] == '\0') {
+		query->refresh_match = MODE_REFRESH_ANY;
+		return true;
+	}
+
+	// ("," or "@") + whitespace + refresh
+	if (cur[0] != ',' && cur[0] != '@') {
+		log_error("invalid mode: expected refresh rate: %s\n", value);
+		return false;
+	}
+	cur++;
+	while (cur[0] == ' ') {
+		cur++;
+	}
+	if (strcmp(cur, "max") == 0) {
+		query->refresh_match = MODE_REFRESH_MAX;
+		return true;
+	}
+
+	query->refresh_match = MODE_REFRESH_EXACT;
+	if (cur[0] == '~') {
+		query->refresh_match = MODE_REFRESH_NEAREST;
+		cur++;
+	}
+	if (!parse_refresh(cur, &query->refresh)) {
+		log_error("invalid mode: invalid refresh rate: %s\n", value);
+		return false;
+	}
+	return true;
+}
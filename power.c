@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+#include "wlr-output-power-management-unstable-v1-client-protocol.h"
+
+/*
+ * --power blanks or wakes up a head through wlr-output-power-management,
+ * leaving its mode and position alone: no modeset, no reflow. That
+ * protocol works on wl_outputs, which are matched to heads by name, so only
+ * enabled heads have one. wl_output globals are recorded during
+ * enumeration but only bound here, and only version 4 sends names.
+ */
+
+struct power_output {
+	struct randr_head *head; // NULL if nothing is requested for it
+	struct wl_output *wl_output;
+	char *name;
+	struct zwlr_output_power_v1 *power;
+	enum zwlr_output_power_v1_mode mode, target;
+	bool has_mode, failed;
+};
+
+struct power_outputs {
+	struct power_output *outputs;
+	size_t len;
+};
+
+bool parse_power(const char *value, enum randr_power *power) {
+	if (strcmp(value, "on") == 0) {
+		*power = RANDR_POWER_ON;
+	} else if (strcmp(value, "off") == 0) {
+		*power = RANDR_POWER_OFF;
+	} else if (strcmp(value, "toggle") == 0) {
+		*power = RANDR_POWER_TOGGLE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void output_handle_geometry(void *data, struct wl_output *wl_output,
+		int32_t x, int32_t y, int32_t phys_width, int32_t phys_height,
+		int32_t subpixel, const char *make, const char *model,
+		int32_t transform) {
+	// Unused
+}
+
+static void output_handle_mode(void *data, struct wl_output *wl_output,
+		uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
+	// Unused
+}
+
+static void output_handle_done(void *data, struct wl_output *wl_output) {
+	// Unused
+}
+
+static void output_handle_scale(void *data, struct wl_output *wl_output,
+		int32_t factor) {
+	// Unused
+}
+
+static void output_handle_name(void *data, struct wl_output *wl_output,
+		const char *name) {
+	struct power_output *output = data;
+	free(output->name);
+	output->name = strdup(name);
+}
+
+static void output_handle_description(void *data,
+		struct wl_output *wl_output, const char *description) {
+	// Unused
+}
+
+static const struct wl_output_listener output_listener = {
+	.geometry = output_handle_geometry,
+	.mode = output_handle_mode,
+	.done = output_handle_done,
+	.scale = output_handle_scale,
+	.name = output_handle_name,
+	.description = output_handle_description,
+};
+
+static void power_handle_mode(void *data, struct zwlr_output_power_v1 *power,
+		uint32_t mode) {
+	struct power_output *output = data;
+	output->mode = mode;
+	output->has_mode = true;
+}
+
+static void power_handle_failed(void *data,
+		struct zwlr_output_power_v1 *power) {
+	struct power_output *output = data;
+	output->failed = true;
+}
+
+static const struct zwlr_output_power_v1_listener power_listener = {
+	.mode = power_handle_mode,
+	.failed = power_handle_failed,
+};
+
+// The mode event comes right after the power object is created
+static bool has_modes(void *data) {
+	const struct power_outputs *outputs = data;
+	for (size_t i = 0; i < outputs->len; i++) {
+		const struct power_output *output = &outputs->outputs[i];
+		if (output->power != NULL && !output->has_mode && !output->failed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool reached_targets(void *data) {
+	const struct power_outputs *outputs = data;
+	for (size_t i = 0; i < outputs->len; i++) {
+		const struct power_output *output = &outputs->outputs[i];
+		if (output->power != NULL && output->mode != output->target &&
+				!output->failed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct power_output *find_power_output(struct power_outputs *outputs,
+		const char *name) {
+	for (size_t i = 0; i < outputs->len; i++) {
+		struct power_output *output = &outputs->outputs[i];
+		if (output->name != NULL && name != NULL &&
+				strcmp(output->name, name) == 0) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+static void finish_power_outputs(struct power_outputs *outputs) {
+	for (size_t i = 0; i < outputs->len; i++) {
+		struct power_output *output = &outputs->outputs[i];
+		if (output->power != NULL) {
+			zwlr_output_power_v1_destroy(output->power);
+		}
+		if (wl_output_get_version(output->wl_output) >=
+				WL_OUTPUT_RELEASE_SINCE_VERSION) {
+			wl_output_release(output->wl_output);
+		} else {
+			wl_output_destroy(output->wl_output);
+		}
+		free(output->name);
+	}
+	free(outputs->outputs);
+}
+
+// Sets the power mode of the heads which have a request, returns an exit code
+int apply_power(struct randr_state *state, struct wl_display *display,
+		struct wl_registry *registry, int timeout) {
+	if (state->power_manager_name == 0) {
+		fprintf(stderr, "compositor doesn't support "
+			"wlr-output-power-management-unstable-v1\n");
+		return EXIT_FAILURE;
+	}
+
+	double deadline = deadline_after(timeout);
+	struct zwlr_output_power_manager_v1 *manager = wl_registry_bind(registry,
+		state->power_manager_name, &zwlr_output_power_manager_v1_interface,
+		1);
+
+	const struct output_global *globals = state->output_globals.data;
+	struct power_outputs outputs = {
+		.len = state->output_globals.size / sizeof(*globals),
+	};
+	outputs.outputs = calloc(outputs.len + 1, sizeof(*outputs.outputs));
+	if (outputs.outputs == NULL) {
+		fprintf(stderr, "failed to allocate outputs\n");
+		zwlr_output_power_manager_v1_destroy(manager);
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < outputs.len; i++) {
+		struct power_output *output = &outputs.outputs[i];
+		uint32_t version = globals[i].version <= 4 ? globals[i].version : 4;
+		output->wl_output = wl_registry_bind(registry, globals[i].name,
+			&wl_output_interface, version);
+		wl_output_add_listener(output->wl_output, &output_listener, output);
+	}
+
+	// Wait for the names
+	enum dispatch_result dispatched = roundtrip_until(display, deadline);
+	int exit_code = dispatch_exit_code(dispatched);
+
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (exit_code != EXIT_SUCCESS) {
+			break;
+		} else if (head->power == RANDR_POWER_NONE) {
+			continue;
+		}
+		struct power_output *output = find_power_output(&outputs, head->name);
+		if (output == NULL) {
+			log_error("no wl_output found for %s, is it enabled?\n",
+				head->name);
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+		output->head = head;
+		output->power = zwlr_output_power_manager_v1_get_output_power(
+			manager, output->wl_output);
+		zwlr_output_power_v1_add_listener(output->power, &power_listener,
+			output);
+	}
+
+	if (exit_code == EXIT_SUCCESS) {
+		dispatched = dispatch_until(display, deadline, has_modes, &outputs);
+		exit_code = dispatch_exit_code(dispatched);
+	}
+
+	for (size_t i = 0; exit_code == EXIT_SUCCESS && i < outputs.len; i++) {
+		struct power_output *output = &outputs.outputs[i];
+		if (output->power == NULL || output->failed) {
+			continue;
+		}
+		switch (output->head->power) {
+		case RANDR_POWER_NONE:
+			break;
+		case RANDR_POWER_ON:
+			output->target = ZWLR_OUTPUT_POWER_V1_MODE_ON;
+			break;
+		case RANDR_POWER_OFF:
+			output->target = ZWLR_OUTPUT_POWER_V1_MODE_OFF;
+			break;
+		case RANDR_POWER_TOGGLE:
+			output->target = output->mode == ZWLR_OUTPUT_POWER_V1_MODE_ON ?
+				ZWLR_OUTPUT_POWER_V1_MODE_OFF : ZWLR_OUTPUT_POWER_V1_MODE_ON;
+			break;
+		}
+		if (output->mode != output->target) {
+			zwlr_output_power_v1_set_mode(output->power, output->target);
+		}
+	}
+
+	// The new mode is sent back once effective
+	if (exit_code == EXIT_SUCCESS) {
+		dispatched = dispatch_until(display, deadline, reached_targets,
+			&outputs);
+		exit_code = dispatch_exit_code(dispatched);
+	}
+
+	bool reached = exit_code == EXIT_SUCCESS;
+	for (size_t i = 0; reached && i < outputs.len; i++) {
+		const struct power_output *output = &outputs.outputs[i];
+		if (output->failed) {
+			log_error("failed to set the power mode of %s\n",
+				output->head->name);
+			exit_code = EXIT_FAILURE;
+		}
+	}
+
+	finish_power_outputs(&outputs);
+	zwlr_output_power_manager_v1_destroy(manager);
+	return exit_code;
+}
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include "randr.h"
+
+static void print_mode(struct randr_head *head, struct randr_mode *mode,
+		struct buffer *buf) {
+	buffer_append_str(buf, "    ");
+	buffer_append_int(buf, mode->width);
+	buffer_append_str(buf, "x");
+	buffer_append_int(buf, mode->height);
+	buffer_append_str(buf, " px");
+	if (mode->refresh > 0) {
+		buffer_printf(buf, ", %f Hz", (float)mode->refresh / 1000);
+	}
+	bool current = head->mode == mode;
+	if (current && mode->preferred) {
+		buffer_append_str(buf, " (preferred, current)");
+	} else if (mode->preferred) {
+		buffer_append_str(buf, " (preferred)");
+	} else if (current) {
+		buffer_append_str(buf, " (current)");
+	}
+	buffer_append_str(buf, "\n");
+}
+
+// The name always heads the block of an output, whatever the fields
+void print_state(struct randr_state *state, const struct randr_query *query,
+		struct buffer *buf) {
+	uint32_t fields = query_fields(query);
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!query_has_head(query, head)) {
+			continue;
+		}
+
+		if (fields & RANDR_FIELD_DESCRIPTION) {
+			buffer_printf(buf, "%s \"%s\"\n", head->name, head->description);
+		} else {
+			buffer_printf(buf, "%s\n", head->name);
+		}
+
+		if (state->version >= 2) {
+			if (fields & RANDR_FIELD_MAKE) {
+				buffer_printf(buf, "  Make: %s\n", head->make);
+			}
+			if (fields & RANDR_FIELD_MODEL) {
+				buffer_printf(buf, "  Model: %s\n", head->model);
+			}
+			if (fields & RANDR_FIELD_SERIAL) {
+				buffer_printf(buf, "  Serial: %s\n", head->serial_number);
+			}
+		}
+
+		if ((fields & RANDR_FIELD_PHYSICAL_SIZE) &&
+				head->phys_width > 0 && head->phys_height > 0) {
+			buffer_printf(buf, "  Physical size: %dx%d mm\n",
+				head->phys_width, head->phys_height);
+		}
+
+		if (fields & RANDR_FIELD_ENABLED) {
+			buffer_append_str(buf, head->enabled ?
+				"  Enabled: yes\n" : "  Enabled: no\n");
+		}
+
+		if ((fields & RANDR_FIELD_MODES) && query_modes_len(query, head) > 0) {
+			buffer_append_str(buf, "  Modes:\n");
+			if (query != NULL && query->current_mode_only) {
+				print_mode(head, head->mode, buf);
+			} else {
+				struct randr_mode *mode;
+				wl_list_for_each(mode, &head->modes, link) {
+					print_mode(head, mode, buf);
+				}
+			}
+		}
+
+		if (!head->enabled) {
+			continue;
+		}
+
+		if (fields & RANDR_FIELD_POSITION) {
+			buffer_printf(buf, "  Position: %d,%d\n", head->x, head->y);
+		}
+		if (fields & RANDR_FIELD_TRANSFORM) {
+			buffer_printf(buf, "  Transform: %s\n",
+				output_transform_map[head->transform]);
+		}
+		if (fields & RANDR_FIELD_SCALE) {
+			buffer_printf(buf, "  Scale: %f\n", head->scale);
+		}
+
+		if ((fields & RANDR_FIELD_ADAPTIVE_SYNC) && state->version >= 4) {
+			switch (head->adaptive_sync_state) {
+			case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED:
+				buffer_append_str(buf, "  Adaptive Sync: enabled\n");
+				break;
+			case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED:
+				buffer_append_str(buf, "  Adaptive Sync: disabled\n");
+				break;
+			}
+		}
+	}
+}
+
+// Starts a member of a head object, after the previous one if any
+static void print_json_key(struct buffer *buf, size_t *count,
+		const char *key) {
+	buffer_append_str(buf, (*count)++ ? ",\n    \"" : "\n    \"");
+	buffer_append_str(buf, key);
+	buffer_append_str(buf, "\": ");
+}
+
+static void print_mode_json(struct randr_head *head, struct randr_mode *mode,
+		struct buffer *buf) {
+	buffer_append_str(buf, "\n      {\n");
+
+	buffer_append_str(buf, "        \"width\": ");
+	buffer_append_int(buf, mode->width);
+	buffer_append_str(buf, ",\n        \"height\": ");
+	buffer_append_int(buf, mode->height);
+	buffer_printf(buf, ",\n        \"refresh\": %f,\n",
+		(float)mode->refresh / 1000);
+	buffer_append_str(buf, mode->preferred ?
+		"        \"preferred\": true,\n" :
+		"        \"preferred\": false,\n");
+	buffer_append_str(buf, head->mode == mode ?
+		"        \"current\": true\n" :
+		"        \"current\": false\n");
+
+	buffer_append_str(buf, "      }");
+}
+
+void print_state_json(struct randr_state *state,
+		const struct randr_query *query, struct buffer *buf) {
+	uint32_t fields = query_fields(query);
+	buffer_append_str(buf, "[");
+
+	size_t heads_count = 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!query_has_head(query, head)) {
+			continue;
+		}
+		if (heads_count++) {
+			buffer_append_str(buf, ",");
+		}
+		buffer_append_str(buf, "\n  {");
+
+		size_t count = 0;
+		if (fields & RANDR_FIELD_NAME) {
+			print_json_key(buf, &count, "name");
+			buffer_append_json_string(buf, head->name);
+		}
+		if (fields & RANDR_FIELD_DESCRIPTION) {
+			print_json_key(buf, &count, "description");
+			buffer_append_json_string(buf, head->description);
+		}
+		if (fields & RANDR_FIELD_MAKE) {
+			print_json_key(buf, &count, "make");
+			buffer_append_json_string(buf, head->make);
+		}
+		if (fields & RANDR_FIELD_MODEL) {
+			print_json_key(buf, &count, "model");
+			buffer_append_json_string(buf, head->model);
+		}
+		if (fields & RANDR_FIELD_SERIAL) {
+			print_json_key(buf, &count, "serial");
+			buffer_append_json_string(buf, head->serial_number);
+		}
+
+		if (fields & RANDR_FIELD_PHYSICAL_SIZE) {
+			print_json_key(buf, &count, "physical_size");
+			buffer_append_str(buf, "{\n      \"width\": ");
+			buffer_append_int(buf, head->phys_width);
+			buffer_append_str(buf, ",\n      \"height\": ");
+			buffer_append_int(buf, head->phys_height);
+			buffer_append_str(buf, "\n    }");
+		}
+
+		if (fields & RANDR_FIELD_ENABLED) {
+			print_json_key(buf, &count, "enabled");
+			buffer_append_str(buf, head->enabled ? "true" : "false");
+		}
+
+		if (fields & RANDR_FIELD_MODES) {
+			print_json_key(buf, &count, "modes");
+			buffer_append_str(buf, "[");
+
+			size_t modes_count = 0;
+			if (query != NULL && query->current_mode_only) {
+				if (head->mode != NULL) {
+					print_mode_json(head, head->mode, buf);
+					modes_count++;
+				}
+			} else {
+				struct randr_mode *mode;
+				wl_list_for_each(mode, &head->modes, link) {
+					if (modes_count++) {
+						buffer_append_str(buf, ",");
+					}
+					print_mode_json(head, mode, buf);
+				}
+			}
+
+			if (modes_count) {
+				buffer_append_str(buf, "\n    ");
+			}
+			buffer_append_str(buf, "]");
+		}
+
+		if (head->enabled) {
+			if (fields & RANDR_FIELD_POSITION) {
+				print_json_key(buf, &count, "position");
+				buffer_append_str(buf, "{\n      \"x\": ");
+				buffer_append_int(buf, head->x);
+				buffer_append_str(buf, ",\n      \"y\": ");
+				buffer_append_int(buf, head->y);
+				buffer_append_str(buf, "\n    }");
+			}
+
+			if (fields & RANDR_FIELD_TRANSFORM) {
+				print_json_key(buf, &count, "transform");
+				buffer_append_json_string(buf,
+					output_transform_map[head->transform]);
+			}
+
+			if (fields & RANDR_FIELD_SCALE) {
+				print_json_key(buf, &count, "scale");
+				buffer_printf(buf, "%f", head->scale);
+			}
+
+			if (fields & RANDR_FIELD_ADAPTIVE_SYNC) {
+				char *adaptive_sync = "null";
+				if (state->version >= 4) {
+					switch (head->adaptive_sync_state) {
+					case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED:
+						adaptive_sync = "true";
+						break;
+					case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED:
+						adaptive_sync = "false";
+						break;
+					}
+				}
+				print_json_key(buf, &count, "adaptive_sync");
+				buffer_append_str(buf, adaptive_sync);
+			}
+		}
+
+		buffer_append_str(buf, count ? "\n  }" : "}");
+	}
+
+	if (heads_count) {
+		buffer_append_str(buf, "\n");
+	}
+	buffer_append_str(buf, "]\n");
+}
+
+void print_state_format(struct randr_state *state, enum randr_format format,
+		const struct randr_query *query, struct buffer *buf) {
+	struct encoder enc;
+	if (encoder_init(&enc, format, buf)) {
+		encode_state(state, query, &enc);
+	} else if (format == RANDR_FORMAT_JSON) {
+		print_state_json(state, query, buf);
+	} else {
+		print_state(state, query, buf);
+	}
+}
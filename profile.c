@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * Profiles are layout files, as read by --from-file, stored in
+ * $XDG_CONFIG_HOME/wlr-randr/profiles:
+ *
+ *     profiles/<name>
+ *     profiles/index/<fingerprint> -> ../<name>
+ *
+ * The fingerprint identifies the connected monitors by make, model and
+ * serial number, in any order, while the profile refers to them by
+ * connector like any layout file. It is a 64-bit hash written as 16 hex
+ * digits, so that the profile for a set of monitors is found with a single
+ * readlink() whatever the number of profiles. The first line of a profile
+ * repeats its fingerprint, which catches index entries left behind by a
+ * profile saved again for other monitors.
+ */
+
+#define PROFILE_HEADER "# wlr-randr profile "
+#define FINGERPRINT_LEN 16
+
+static bool get_profiles_path(char *path, size_t size, const char *suffix) {
+	int n;
+	const char *config_home = getenv("XDG_CONFIG_HOME");
+	if (config_home != NULL && config_home[0] != '\0') {
+		n = snprintf(path, size, "%s/wlr-randr/profiles%s",
+			config_home, suffix);
+	} else {
+		const char *home = getenv("HOME");
+		if (home == NULL) {
+			return false;
+		}
+		n = snprintf(path, size, "%s/.config/wlr-randr/profiles%s",
+			home, suffix);
+	}
+	return n > 0 && (size_t)n < size;
+}
+
+// Like mkdir -p
+static bool make_dirs(char *path) {
+	for (char *slash = strchr(path + 1, '/'); slash != NULL;
+			slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+		*slash = '/';
+		if (!ok) {
+			return false;
+		}
+	}
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static int compare_strings(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void append_identity(struct buffer *buf, const char *str) {
+	buffer_append_str(buf, str != NULL ? str : "");
+	buffer_append(buf, "\x1f", 1);
+}
+
+bool state_fingerprint(struct randr_state *state, uint64_t *fingerprint) {
+	size_t len = wl_list_length(&state->heads);
+	struct buffer buf = {0};
+	size_t *offsets = calloc(len + 1, sizeof(*offsets));
+	char **keys = calloc(len + 1, sizeof(*keys));
+	if (offsets == NULL || keys == NULL) {
+		free(offsets);
+		free(keys);
+		fprintf(stderr, "failed to allocate fingerprint\n");
+		return false;
+	}
+
+	// Without make, model and serial number, only the name is left
+	size_t i = 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		offsets[i++] = buf.len;
+		if (head->make == NULL && head->model == NULL &&
+				head->serial_number == NULL) {
+			append_identity(&buf, head->name);
+		} else {
+			append_identity(&buf, head->make);
+			append_identity(&buf, head->model);
+			append_identity(&buf, head->serial_number);
+		}
+		buffer_append(&buf, "", 1);
+	}
+	bool ok = !buf.failed;
+	if (ok) {
+		for (i = 0; i < len; i++) {
+			keys[i] = buf.data + offsets[i];
+		}
+		qsort(keys, len, sizeof(*keys), compare_strings);
+
+		uint64_t hash = HASH_BYTES64_INIT;
+		for (i = 0; i < len; i++) {
+			hash = hash_bytes64(hash, keys[i], strlen(keys[i]) + 1);
+		}
+		*fingerprint = hash;
+	} else {
+		fprintf(stderr, "failed to allocate fingerprint\n");
+	}
+
+	free(keys);
+	free(offsets);
+	buffer_finish(&buf);
+	return ok;
+}
+
+static bool is_valid_name(const char *name) {
+	return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL &&
+		strcmp(name, "index") != 0 && strlen(name) < NAME_MAX;
+}
+
+// Modes without a refresh rate are written without one, 0 Hz is invalid
+static void write_mode(struct buffer *buf, const char *option,
+		int32_t width, int32_t height, int32_t refresh) {
+	buffer_printf(buf, " %s %dx%d", option, width, height);
+	if (refresh > 0) {
+		buffer_printf(buf, "@%d.%03dHz", refresh / 1000, refresh % 1000);
+	}
+}
+
+static void write_profile(struct randr_state *state, uint64_t fingerprint,
+		struct buffer *buf) {
+	buffer_printf(buf, PROFILE_HEADER "%016" PRIx64 "\n", fingerprint);
+
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (head->name == NULL) {
+			continue;
+		}
+		buffer_append_str(buf, "output ");
+		buffer_append_str(buf, head->name);
+		if (!head->enabled) {
+			buffer_append_str(buf, " off\n");
+			continue;
+		}
+
+		buffer_append_str(buf, " on");
+		if (head->mode != NULL) {
+			write_mode(buf, "mode", head->mode->width, head->mode->height,
+				head->mode->refresh);
+		} else if (head->custom_mode.width > 0) {
+			write_mode(buf, "custom-mode", head->custom_mode.width,
+				head->custom_mode.height, head->custom_mode.refresh);
+		}
+		buffer_printf(buf, " pos %d,%d transform %s scale %.9g",
+			head->x, head->y, output_transform_map[head->transform],
+			head->scale);
+		if (state->version >=
+				ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_SET_ADAPTIVE_SYNC_SINCE_VERSION) {
+			buffer_append_str(buf, head->adaptive_sync_state ==
+				ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED ?
+				" adaptive-sync enabled" : " adaptive-sync disabled");
+		}
+		buffer_append_str(buf, "\n");
+	}
+}
+
+// Written to a temporary file first, so that readers never see half of it
+static bool replace_file(const char *path, const struct buffer *buf) {
+	char tmp_path[PATH_MAX];
+	int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		fprintf(stderr, "profile path is too long\n");
+		return false;
+	}
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", tmp_path, strerror(errno));
+		return false;
+	}
+	bool ok = write_all(fd, buf->data, buf->len);
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		fprintf(stderr, "failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+static bool replace_symlink(const char *target, const char *path) {
+	char tmp_path[PATH_MAX];
+	int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		fprintf(stderr, "profile path is too long\n");
+		return false;
+	}
+
+	unlink(tmp_path);
+	if (symlink(target, tmp_path) != 0 || rename(tmp_path, path) != 0) {
+		fprintf(stderr, "failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+bool save_profile(struct randr_state *state, const char *name) {
+	if (!is_valid_name(name)) {
+		fprintf(stderr, "invalid profile name: %s\n", name);
+		return false;
+	}
+
+	char index_dir[PATH_MAX];
+	if (!get_profiles_path(index_dir, sizeof(index_dir), "/index")) {
+		fprintf(stderr, "HOME is not set or the profile path is too long\n");
+		return false;
+	}
+	if (!make_dirs(index_dir)) {
+		fprintf(stderr, "failed to create %s: %s\n", index_dir,
+			strerror(errno));
+		return false;
+	}
+
+	uint64_t fingerprint;
+	if (!state_fingerprint(state, &fingerprint)) {
+		return false;
+	}
+
+	char suffix[NAME_MAX + 16];
+	char path[PATH_MAX], index_path[PATH_MAX], target[NAME_MAX + 4];
+	snprintf(suffix, sizeof(suffix), "/%s", name);
+	snprintf(target, sizeof(target), "../%s", name);
+	bool ok = get_profiles_path(path, sizeof(path), suffix);
+	snprintf(suffix, sizeof(suffix), "/index/%016" PRIx64, fingerprint);
+	ok = ok && get_profiles_path(index_path, sizeof(index_path), suffix);
+	if (!ok) {
+		fprintf(stderr, "profile path is too long\n");
+		return false;
+	}
+
+	struct buffer buf = {0};
+	write_profile(state, fingerprint, &buf);
+	if (buf.failed) {
+		fprintf(stderr, "failed to allocate profile\n");
+		buffer_finish(&buf);
+		return false;
+	}
+	ok = replace_file(path, &buf) && replace_symlink(target, index_path);
+	buffer_finish(&buf);
+	return ok;
+}
+
+/*
+ * Fills in the path of the profile for the fingerprint and its name, which
+ * points into the path. Returns false if there is none.
+ */
+static bool find_profile(uint64_t fingerprint, char *path, size_t size,
+		const char **name) {
+	char suffix[32], index_path[PATH_MAX], target[NAME_MAX + 4];
+	snprintf(suffix, sizeof(suffix), "/index/%016" PRIx64, fingerprint);
+	if (!get_profiles_path(index_path, sizeof(index_path), suffix)) {
+		return false;
+	}
+	ssize_t len = readlink(index_path, target, sizeof(target) - 1);
+	if (len < 0) {
+		return false;
+	}
+	target[len] = '\0';
+	if (strncmp(target, "../", 3) != 0 || !is_valid_name(target + 3)) {
+		return false;
+	}
+
+	char name_suffix[NAME_MAX + 2];
+	snprintf(name_suffix, sizeof(name_suffix), "/%s", target + 3);
+	if (!get_profiles_path(path, size, name_suffix)) {
+		return false;
+	}
+	*name = strrchr(path, '/') + 1;
+
+	// The profile may have been saved again for other monitors
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	char header[sizeof(PROFILE_HEADER) + FINGERPRINT_LEN + 1];
+	bool ok = fgets(header, sizeof(header), f) != NULL;
+	fclose(f);
+	char expected[sizeof(header)];
+	snprintf(expected, sizeof(expected), PROFILE_HEADER "%016" PRIx64,
+		fingerprint);
+	return ok && strncmp(header, expected, strlen(expected)) == 0;
+}
+
+static int apply_profile(struct randr_state *state,
+		struct wl_display *display, const char *path, int timeout) {
+	struct layout_snapshot original;
+	if (!take_layout_snapshot(state, &original)) {
+		return EXIT_FAILURE;
+	}
+
+	struct randr_command cmd = {
+		.no_op_skip = true,
+		.apply_timeout = timeout,
+	};
+	int exit_code = EXIT_FAILURE;
+	if (parse_layout_file(state, path, &cmd.changed) &&
+			check_layout(state)) {
+		exit_code = run_transaction(state, display, &original, &cmd);
+	}
+
+	finish_layout_snapshot(&original);
+	reset_heads(state);
+	return exit_code;
+}
+
+/*
+ * Called after events have been dispatched: applies the profile of the
+ * connected monitors when they change. The new state this brings has the
+ * same fingerprint, so the profile isn't applied again.
+ */
+void update_auto_profile(struct auto_profile *auto_profile,
+		struct randr_state *state, struct wl_display *display, int timeout) {
+	if (auto_profile->has_serial && auto_profile->serial == state->serial) {
+		return;
+	}
+	auto_profile->serial = state->serial;
+	auto_profile->has_serial = true;
+
+	uint64_t fingerprint;
+	if (!state_fingerprint(state, &fingerprint) ||
+			(auto_profile->has_fingerprint &&
+			auto_profile->fingerprint == fingerprint)) {
+		return;
+	}
+	auto_profile->fingerprint = fingerprint;
+	auto_profile->has_fingerprint = true;
+
+	char path[PATH_MAX];
+	const char *name;
+	if (!find_profile(fingerprint, path, sizeof(path), &name)) {
+		return;
+	}
+	fprintf(stderr, "applying profile %s\n", name);
+	if (apply_profile(state, display, path, timeout) != EXIT_SUCCESS) {
+		fprintf(stderr, "failed to apply profile %s\n", name);
+	}
+}
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include "randr.h"
+
+/*
+ * Queries can be narrowed down to some heads, some of their properties and
+ * their current mode. Printers skip whatever is left out instead of
+ * filtering their output, so that long mode lists aren't even walked when
+ * only the current mode is wanted.
+ */
+
+static const struct {
+	const char *name;
+	uint32_t fields;
+} field_names[] = {
+	{ "name", RANDR_FIELD_NAME },
+	{ "description", RANDR_FIELD_DESCRIPTION },
+	{ "make", RANDR_FIELD_MAKE },
+	{ "model", RANDR_FIELD_MODEL },
+	{ "serial", RANDR_FIELD_SERIAL },
+	{ "physical_size", RANDR_FIELD_PHYSICAL_SIZE },
+	{ "enabled", RANDR_FIELD_ENABLED },
+	{ "modes", RANDR_FIELD_MODES },
+	{ "mode", RANDR_FIELD_MODES }, // and --current-mode-only
+	{ "position", RANDR_FIELD_POSITION },
+	{ "transform", RANDR_FIELD_TRANSFORM },
+	{ "scale", RANDR_FIELD_SCALE },
+	{ "adaptive_sync", RANDR_FIELD_ADAPTIVE_SYNC },
+};
+
+// Calls fn for each item of a comma-separated list, stops if it fails
+static bool for_each_item(const char *list,
+		bool (*fn)(const char *item, size_t len, void *data), void *data) {
+	const char *cur = list;
+	while (1) {
+		size_t len = strcspn(cur, ",");
+		if (!fn(cur, len, data)) {
+			return false;
+		}
+		if (cur[len] == '\0') {
+			return true;
+		}
+		cur += len + 1;
+	}
+}
+
+static bool add_field(const char *item, size_t len, void *data) {
+	struct randr_query *query = data;
+	size_t field_names_len = sizeof(field_names) / sizeof(field_names[0]);
+	for (size_t i = 0; i < field_names_len; i++) {
+		if (strlen(field_names[i].name) == len &&
+				strncmp(field_names[i].name, item, len) == 0) {
+			query->fields |= field_names[i].fields;
+			if (strcmp(field_names[i].name, "mode") == 0) {
+				query->current_mode_only = true;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parse_fields(const char *value, struct randr_query *query) {
+	return for_each_item(value, add_field, query);
+}
+
+static bool check_name(const char *item, size_t len, void *data) {
+	return len > 0;
+}
+
+// enabled, disabled or a list of output names
+bool parse_output_filter(const char *value, struct randr_query *query) {
+	if (strcmp(value, "enabled") == 0) {
+		query->filter = RANDR_OUTPUT_ENABLED;
+	} else if (strcmp(value, "disabled") == 0) {
+		query->filter = RANDR_OUTPUT_DISABLED;
+	} else if (for_each_item(value, check_name, NULL)) {
+		query->filter = RANDR_OUTPUT_NAMED;
+		query->names = value;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool is_other_name(const char *item, size_t len, void *data) {
+	const char *name = data;
+	return strlen(name) != len || strncmp(name, item, len) != 0;
+}
+
+bool query_has_head(const struct randr_query *query,
+		const struct randr_head *head) {
+	if (query == NULL) {
+		return true;
+	}
+	switch (query->filter) {
+	case RANDR_OUTPUT_ALL:
+		return true;
+	case RANDR_OUTPUT_ENABLED:
+		return head->enabled;
+	case RANDR_OUTPUT_DISABLED:
+		return !head->enabled;
+	case RANDR_OUTPUT_NAMED:
+		// The walk stops early on the matching name
+		return head->name != NULL &&
+			!for_each_item(query->names, is_other_name, head->name);
+	}
+	return true;
+}
+
+uint32_t query_fields(const struct randr_query *query) {
+	if (query == NULL || query->fields == 0) {
+		return RANDR_FIELD_ALL;
+	}
+	return query->fields;
+}
+
+size_t query_heads_len(const struct randr_query *query,
+		struct randr_state *state) {
+	size_t len = 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		len += query_has_head(query, head);
+	}
+	return len;
+}
+
+size_t query_modes_len(const struct randr_query *query,
+		const struct randr_head *head) {
+	if (query != NULL && query->current_mode_only) {
+		return head->mode != NULL;
+	}
+	return wl_list_length(&head->modes);
+}
@@ -0,0 +1,594 @@
+#ifndef RANDR_H
+#define RANDR_H
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include "wlr-output-management-unstable-v1-client-protocol.h"
+
+// Like timeout(1)
+#define EXIT_TIMEOUT 124
+
+struct pollfd;
+struct randr_state;
+struct randr_head;
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *blocks;
+};
+
+struct hash_entry {
+	uint32_t hash;
+	void *value; // NULL if the slot is free
+};
+
+struct hash_table {
+	struct hash_entry *entries;
+	size_t len, cap;
+};
+
+struct hash_iter {
+	uint32_t hash;
+	size_t pos;
+};
+
+struct randr_mode {
+	struct randr_head *head;
+	struct zwlr_output_mode_v1 *wlr_mode;
+	struct wl_list link;
+	uint32_t seq; // advertisement order within the head
+
+	int32_t width, height;
+	int32_t refresh; // mHz
+	bool preferred;
+};
+
+// Packed copy of a mode for lookups, see modes.c
+struct randr_mode_entry {
+	int32_t width, height;
+	int32_t refresh; // mHz
+	uint32_t index; // in randr_head.mode_records, advertisement order
+};
+
+enum randr_head_prop {
+	RANDR_HEAD_MODE = 1 << 0,
+	RANDR_HEAD_POSITION = 1 << 1,
+	RANDR_HEAD_TRANSFORM = 1 << 2,
+	RANDR_HEAD_SCALE = 1 << 3,
+	RANDR_HEAD_ADAPTIVE_SYNC = 1 << 4,
+};
+
+// A --power request
+enum randr_power {
+	RANDR_POWER_NONE,
+	RANDR_POWER_ON,
+	RANDR_POWER_OFF,
+	RANDR_POWER_TOGGLE,
+};
+
+struct randr_head {
+	struct randr_state *state;
+	struct zwlr_output_head_v1 *wlr_head;
+	struct wl_list link;
+	// Holds the head itself, its modes and its strings
+	struct arena arena;
+
+	char *name, *description;
+	char *make, *model, *serial_number;
+	int32_t phys_width, phys_height; // mm
+	struct wl_list modes;
+	struct wl_list free_modes; // finished, kept for reuse
+	struct hash_table modes_by_proxy;
+	uint32_t next_mode_seq;
+	// Sorted by size then refresh rate, rebuilt when modes change
+	struct randr_mode_entry *sorted_modes;
+	struct randr_mode **mode_records;
+	size_t sorted_modes_len, sorted_modes_cap;
+	bool sorted_modes_valid;
+
+	uint32_t changed; // enum randr_head_prop
+	enum randr_power power; // not part of the configuration
+	bool enabled;
+	struct randr_mode *mode;
+	struct {
+		int32_t width, height;
+		int32_t refresh;
+	} custom_mode;
+	int32_t x, y;
+	enum wl_output_transform transform;
+	double scale;
+	enum zwlr_output_head_v1_adaptive_sync_state adaptive_sync_state;
+
+	// As last sent by the compositor, the fields above are edited in place
+	// by the requested changes
+	struct {
+		bool enabled;
+		struct randr_mode *mode;
+		int32_t x, y;
+		enum wl_output_transform transform;
+		wl_fixed_t scale;
+		enum zwlr_output_head_v1_adaptive_sync_state adaptive_sync_state;
+	} reported;
+};
+
+// Events received, for --timings
+enum randr_event {
+	RANDR_EVENT_REGISTRY_GLOBAL,
+	RANDR_EVENT_MANAGER_HEAD,
+	RANDR_EVENT_MANAGER_DONE,
+	RANDR_EVENT_MANAGER_FINISHED,
+	RANDR_EVENT_HEAD_NAME,
+	RANDR_EVENT_HEAD_DESCRIPTION,
+	RANDR_EVENT_HEAD_PHYSICAL_SIZE,
+	RANDR_EVENT_HEAD_MODE,
+	RANDR_EVENT_HEAD_ENABLED,
+	RANDR_EVENT_HEAD_CURRENT_MODE,
+	RANDR_EVENT_HEAD_POSITION,
+	RANDR_EVENT_HEAD_TRANSFORM,
+	RANDR_EVENT_HEAD_SCALE,
+	RANDR_EVENT_HEAD_FINISHED,
+	RANDR_EVENT_HEAD_MAKE,
+	RANDR_EVENT_HEAD_MODEL,
+	RANDR_EVENT_HEAD_SERIAL_NUMBER,
+	RANDR_EVENT_HEAD_ADAPTIVE_SYNC,
+	RANDR_EVENT_MODE_SIZE,
+	RANDR_EVENT_MODE_REFRESH,
+	RANDR_EVENT_MODE_PREFERRED,
+	RANDR_EVENT_MODE_FINISHED,
+	RANDR_EVENT_COUNT,
+};
+
+enum randr_phase {
+	RANDR_PHASE_CONNECT,
+	RANDR_PHASE_REGISTRY,
+	RANDR_PHASE_ENUMERATE,
+	RANDR_PHASE_PARSE,
+	RANDR_PHASE_CREATE,
+	RANDR_PHASE_TEST,
+	RANDR_PHASE_APPLY,
+	RANDR_PHASE_DONE,
+	RANDR_PHASE_OUTPUT,
+	RANDR_PHASE_COUNT,
+};
+
+struct randr_timings {
+	double phases[RANDR_PHASE_COUNT]; // seconds, summed over attempts
+	uint32_t recorded; // bitmask of phases
+	int attempts; // of the configuration
+};
+
+// Notifications for long-running modes, all optional
+struct randr_state_listener {
+	// A batch of changes has been fully received
+	void (*done)(void *data, struct randr_state *state);
+	// The head is about to be destroyed
+	void (*head_finished)(void *data, struct randr_head *head);
+};
+
+// A wl_output global, only bound when needed
+struct output_global {
+	uint32_t name, version;
+};
+
+struct randr_state {
+	struct zwlr_output_manager_v1 *output_manager;
+	uint32_t version; // of the output manager
+	// For --power, 0 if there is no power manager
+	uint32_t power_manager_name;
+	struct wl_array output_globals; // struct output_global
+
+	struct wl_list heads;
+	struct hash_table heads_by_name;
+	uint32_t serial;
+	bool has_serial;
+
+	struct randr_timings timings;
+	uint64_t events[RANDR_EVENT_COUNT];
+
+	const struct randr_state_listener *listener;
+	void *listener_data;
+};
+
+// Growable output buffer, written out in one go
+struct buffer {
+	char *data;
+	size_t len, cap;
+	bool failed; // an allocation failed, contents are truncated
+};
+
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json_value {
+	enum json_type type;
+	bool boolean;
+	double number;
+	char *string;
+	// Arrays and objects
+	struct json_value *items;
+	char **keys; // objects only
+	size_t len;
+};
+
+enum randr_format {
+	RANDR_FORMAT_TEXT,
+	RANDR_FORMAT_JSON,
+	RANDR_FORMAT_JSON_COMPACT,
+	RANDR_FORMAT_CBOR,
+	RANDR_FORMAT_MSGPACK,
+};
+
+// Displays given on the command line, empty for the default one
+struct display_list {
+	char **names;
+	size_t len;
+	bool all; // --all-displays
+	enum randr_format format;
+};
+
+struct randr_box {
+	int32_t x, y, width, height;
+};
+
+enum randr_arrange {
+	RANDR_ARRANGE_NONE,
+	RANDR_ARRANGE_LEFT_TO_RIGHT,
+	RANDR_ARRANGE_GRID,
+};
+
+#define ENCODER_MAX_DEPTH 8
+
+// Writes one of the machine-readable formats, see encode.c
+struct encoder {
+	const struct encoder_impl *impl;
+	struct buffer *buf;
+	// JSON only
+	bool nonempty[ENCODER_MAX_DEPTH];
+	size_t depth;
+	bool after_key;
+};
+
+// Properties of a head, for --fields
+enum randr_field {
+	RANDR_FIELD_NAME = 1 << 0,
+	RANDR_FIELD_DESCRIPTION = 1 << 1,
+	RANDR_FIELD_MAKE = 1 << 2,
+	RANDR_FIELD_MODEL = 1 << 3,
+	RANDR_FIELD_SERIAL = 1 << 4,
+	RANDR_FIELD_PHYSICAL_SIZE = 1 << 5,
+	RANDR_FIELD_ENABLED = 1 << 6,
+	RANDR_FIELD_MODES = 1 << 7,
+	RANDR_FIELD_POSITION = 1 << 8,
+	RANDR_FIELD_TRANSFORM = 1 << 9,
+	RANDR_FIELD_SCALE = 1 << 10,
+	RANDR_FIELD_ADAPTIVE_SYNC = 1 << 11,
+	RANDR_FIELD_ALL = (1 << 12) - 1,
+};
+
+enum randr_output_filter {
+	RANDR_OUTPUT_ALL,
+	RANDR_OUTPUT_ENABLED,
+	RANDR_OUTPUT_DISABLED,
+	RANDR_OUTPUT_NAMED,
+};
+
+// What a query prints, everything when zeroed or NULL
+struct randr_query {
+	uint32_t fields; // enum randr_field, 0 for all
+	enum randr_output_filter filter;
+	const char *names; // comma-separated, for RANDR_OUTPUT_NAMED
+	bool current_mode_only;
+};
+
+struct randr_command {
+	bool changed, dry_run, no_op_skip, test_then_apply;
+	bool power; // some head has a power request
+	enum randr_format format;
+	struct randr_query query;
+	bool help, daemon, watch;
+	bool cache, cached;
+	int confirm; // seconds, 0 if disabled
+	bool timings;
+	int enumerate_timeout, apply_timeout; // ms, 0 if disabled
+	enum randr_arrange arrange;
+	const char *save_profile;
+	bool auto_profile;
+	bool stdin_commands;
+	struct display_list displays; // only filled in by check_command()
+
+	// Where the command can run, from the flags of its options
+	bool local; // can't be forwarded to a daemon
+	bool uncached; // can't be answered from the cache
+	const char *exclusive; // option which can't run on several displays
+};
+
+// Keeps the cache up to date, see cache.c
+struct cache_writer {
+	int lock_fd;
+	uint32_t generation;
+	double touched; // as returned by timings_now()
+};
+
+// Last state seen by --auto-profile
+struct auto_profile {
+	uint32_t serial;
+	bool has_serial;
+	uint64_t fingerprint; // of the connected monitors
+	bool has_fingerprint;
+};
+
+enum mode_size_match {
+	MODE_SIZE_EXACT,
+	MODE_SIZE_MAX,
+	MODE_SIZE_CURRENT,
+};
+
+enum mode_refresh_match {
+	MODE_REFRESH_ANY,
+	MODE_REFRESH_MAX,
+	MODE_REFRESH_EXACT, // within rounding errors
+	MODE_REFRESH_NEAREST,
+};
+
+// A --mode argument
+struct mode_query {
+	enum mode_size_match size;
+	int32_t width, height;
+	enum mode_refresh_match refresh_match;
+	int32_t refresh; // mHz
+};
+
+enum dispatch_result {
+	DISPATCH_DONE,
+	DISPATCH_TIMEOUT,
+	DISPATCH_FAILED,
+};
+
+// Configuration of a head, independent from the protocol objects
+struct head_config {
+	char *name;
+	uint32_t changed; // enum randr_head_prop
+	bool enabled, set_enabled;
+	bool has_mode, custom;
+	int32_t width, height, refresh;
+	int32_t x, y;
+	enum wl_output_transform transform;
+	double scale;
+	enum zwlr_output_head_v1_adaptive_sync_state adaptive_sync_state;
+};
+
+struct layout_snapshot {
+	struct head_config *heads;
+	size_t len;
+};
+
+extern const char *output_transform_map[8];
+extern const struct option long_options[];
+extern const char usage[];
+
+// buffer.c
+void buffer_finish(struct buffer *buf);
+void buffer_append(struct buffer *buf, const char *data, size_t size);
+void buffer_append_str(struct buffer *buf, const char *str);
+void buffer_append_int(struct buffer *buf, int64_t value);
+void buffer_printf(struct buffer *buf, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void buffer_append_json_string(struct buffer *buf, const char *str);
+bool buffer_write(struct buffer *buf, int fd);
+bool write_all(int fd, const void *data, size_t size);
+
+// arena.c
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *str);
+void arena_finish(struct arena *arena);
+
+// hash.c
+#define HASH_BYTES64_INIT 14695981039346656037u
+
+uint32_t hash_string(const char *str);
+uint64_t hash_bytes64(uint64_t hash, const void *data, size_t len);
+uint32_t hash_u64(uint64_t value);
+uint32_t hash_ptr(const void *ptr);
+void hash_table_finish(struct hash_table *table);
+bool hash_table_insert(struct hash_table *table, uint32_t hash, void *value);
+void hash_table_remove(struct hash_table *table, uint32_t hash,
+	const void *value);
+void *hash_table_first(const struct hash_table *table, uint32_t hash,
+	struct hash_iter *iter);
+void *hash_table_next(const struct hash_table *table, struct hash_iter *iter);
+
+// state.c
+struct randr_head *create_head(struct randr_state *state,
+	struct zwlr_output_head_v1 *wlr_head);
+void set_head_name(struct randr_head *head, const char *name);
+struct randr_mode *create_mode(struct randr_head *head,
+	struct zwlr_output_mode_v1 *wlr_mode);
+void set_mode_size(struct randr_mode *mode, int32_t width, int32_t height);
+void free_head(struct randr_head *head);
+struct randr_head *find_head(struct randr_state *state, const char *name);
+struct randr_mode *find_mode_by_proxy(struct randr_head *head,
+	struct zwlr_output_mode_v1 *wlr_mode);
+int enumerate_state(struct randr_state *state, struct wl_display *display,
+	double deadline, struct wl_registry **registry);
+void destroy_state(struct randr_state *state);
+
+// modes.c
+void invalidate_sorted_modes(struct randr_head *head);
+bool sort_modes(struct randr_head *head);
+void finish_sorted_modes(struct randr_head *head);
+struct randr_mode *find_mode(struct randr_head *head,
+	int32_t width, int32_t height, int32_t refresh);
+bool parse_mode_query(const char *value, struct mode_query *query);
+struct randr_mode *select_mode(struct randr_head *head,
+	const struct mode_query *query);
+struct randr_mode *preferred_mode(struct randr_head *head);
+struct randr_mode *default_mode(struct randr_head *head);
+
+// print.c
+void print_state(struct randr_state *state, const struct randr_query *query,
+	struct buffer *buf);
+void print_state_json(struct randr_state *state,
+	const struct randr_query *query, struct buffer *buf);
+void print_state_format(struct randr_state *state, enum randr_format format,
+	const struct randr_query *query, struct buffer *buf);
+
+// query.c
+bool parse_fields(const char *value, struct randr_query *query);
+bool parse_output_filter(const char *value, struct randr_query *query);
+bool query_has_head(const struct randr_query *query,
+	const struct randr_head *head);
+uint32_t query_fields(const struct randr_query *query);
+size_t query_heads_len(const struct randr_query *query,
+	struct randr_state *state);
+size_t query_modes_len(const struct randr_query *query,
+	const struct randr_head *head);
+
+// encode.c
+bool parse_format(const char *value, enum randr_format *format);
+bool encoder_init(struct encoder *enc, enum randr_format format,
+	struct buffer *buf);
+void encode_begin_array(struct encoder *enc, size_t len);
+void encode_end_array(struct encoder *enc);
+void encode_begin_map(struct encoder *enc, size_t len);
+void encode_end_map(struct encoder *enc);
+void encode_key(struct encoder *enc, const char *key);
+void encode_string(struct encoder *enc, const char *str);
+void encode_integer(struct encoder *enc, int64_t value);
+void encode_boolean(struct encoder *enc, bool value);
+void encode_null(struct encoder *enc);
+void encode_raw(struct encoder *enc, const char *data, size_t size);
+void encode_finish(struct encoder *enc);
+void encode_state(struct randr_state *state, const struct randr_query *query,
+	struct encoder *enc);
+
+// commands.c
+int run_commands(struct randr_state *state, struct wl_display *display,
+	const struct randr_command *cmd);
+
+// coordinator.c
+int open_apply_lock(double deadline, int *fd);
+void close_apply_lock(int fd);
+int coordinate_apply(struct randr_state *state, struct wl_display *display,
+	const struct layout_snapshot *target, bool test_first, double deadline,
+	struct randr_timings *timings);
+
+// config.c
+void set_error_file(FILE *f);
+void log_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+bool output_option_takes_value(const char *name);
+bool parse_output_arg(struct randr_head *head,
+	const char *name, const char *value);
+bool parse_timeout(const char *value, struct randr_command *cmd);
+bool check_command(int argc, char *argv[], struct randr_command *cmd);
+bool parse_command(struct randr_state *state, int argc, char *argv[],
+	struct randr_command *cmd);
+uint32_t head_diff(const struct randr_head *head);
+bool layout_differs(struct randr_state *state);
+struct zwlr_output_configuration_v1 *apply_state(struct randr_state *state,
+	bool dry_run,
+	const struct zwlr_output_configuration_v1_listener *listener, void *data);
+
+// arrange.c
+bool parse_arrange(const char *value, enum randr_arrange *arrange);
+bool get_head_box(const struct randr_head *head, struct randr_box *box);
+bool check_layout(struct randr_state *state);
+void auto_arrange(struct randr_state *state, enum randr_arrange arrange);
+
+// layout.c
+bool parse_layout_file(struct randr_state *state, const char *path,
+	bool *changed);
+
+// json.c
+bool json_parse(struct json_value *value, const char *text,
+	size_t *error_offset, const char **error);
+void json_finish(struct json_value *value);
+const struct json_value *json_object_get(const struct json_value *object,
+	const char *key);
+
+// cache.c
+bool start_cache(struct cache_writer *writer);
+void finish_cache(struct cache_writer *writer);
+double touch_cache(struct cache_writer *writer);
+bool write_cache(struct cache_writer *writer, struct randr_state *state);
+bool print_cache(enum randr_format format, const struct randr_query *query,
+	int *exit_code);
+
+// profile.c
+bool state_fingerprint(struct randr_state *state, uint64_t *fingerprint);
+bool save_profile(struct randr_state *state, const char *name);
+void update_auto_profile(struct auto_profile *auto_profile,
+	struct randr_state *state, struct wl_display *display, int timeout);
+
+// tested.c
+bool tested_layout_key(struct randr_state *state,
+	const struct layout_snapshot *target, uint64_t *key);
+bool is_tested_layout(uint64_t key);
+void add_tested_layout(uint64_t key);
+void remove_tested_layout(uint64_t key);
+
+// runtime.c
+bool get_runtime_path(char *path, size_t size, const char *suffix);
+
+// displays.c
+bool add_display(struct display_list *displays, const char *name);
+bool collect_displays(struct randr_command *cmd);
+void finish_displays(struct display_list *displays);
+bool run_displays(const struct display_list *displays, int *exit_code);
+
+// loop.c
+double deadline_after(int timeout_ms);
+int poll_display(struct wl_display *display, struct pollfd *fds,
+	size_t fds_len, double deadline);
+enum dispatch_result dispatch_until(struct wl_display *display,
+	double deadline, bool (*done)(void *data), void *data);
+enum dispatch_result roundtrip_until(struct wl_display *display,
+	double deadline);
+int dispatch_exit_code(enum dispatch_result result);
+
+// daemon.c
+bool daemon_forward(int argc, char *argv[], int *exit_code);
+int run_daemon(struct randr_state *state, struct wl_display *display,
+	const struct randr_command *cmd);
+
+// timings.c
+double timings_now(void);
+double record_phase(struct randr_timings *timings, enum randr_phase phase,
+	double start);
+void merge_timings(struct randr_timings *dst, const struct randr_timings *src);
+void print_phase_timings(const char *label,
+	const struct randr_timings *timings);
+void print_timings(struct randr_state *state, bool json);
+
+// transaction.c
+bool take_layout_snapshot(struct randr_state *state,
+	struct layout_snapshot *snapshot);
+void finish_layout_snapshot(struct layout_snapshot *snapshot);
+bool restore_layout_snapshot(struct randr_state *state,
+	const struct layout_snapshot *snapshot, bool full);
+void reset_heads(struct randr_state *state);
+int apply_snapshot(struct randr_state *state, struct wl_display *display,
+	const struct layout_snapshot *snapshot, bool full, bool test_first,
+	bool dry_run, double deadline, struct randr_timings *timings);
+int run_transaction(struct randr_state *state, struct wl_display *display,
+	const struct layout_snapshot *original, const struct randr_command *cmd);
+
+// power.c
+bool parse_power(const char *value, enum randr_power *power);
+int apply_power(struct randr_state *state, struct wl_display *display,
+	struct wl_registry *registry, int timeout);
+
+// watch.c
+int run_watch(struct randr_state *state, struct wl_display *display,
+	const struct randr_command *cmd);
+
+#endif
@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+
+// Files in the runtime directory are per compositor: name them after it
+bool get_runtime_path(char *path, size_t size, const char *suffix) {
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL) {
+		return false;
+	}
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (display == NULL) {
+		display = "wayland-0";
+	}
+	const char *slash = strrchr(display, '/');
+	if (slash != NULL) {
+		display = slash + 1;
+	}
+
+	int n = snprintf(path, size, "%s/wlr-randr-%s%s",
+		runtime_dir, display, suffix);
+	return n > 0 && (size_t)n < size;
+}
@@ -0,0 +1,472 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "randr.h"
+#include "wlr-output-power-management-unstable-v1-client-protocol.h"
+
+const char *output_transform_map[8] = {
+	[WL_OUTPUT_TRANSFORM_NORMAL] = "normal",
+	[WL_OUTPUT_TRANSFORM_90] = "90",
+	[WL_OUTPUT_TRANSFORM_180] = "180",
+	[WL_OUTPUT_TRANSFORM_270] = "270",
+	[WL_OUTPUT_TRANSFORM_FLIPPED] = "flipped",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_90] = "flipped-90",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_180] = "flipped-180",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_270] = "flipped-270",
+};
+
+// Strings live in the head arena: only allocate again if they changed
+static void replace_string(struct randr_head *head, char **dst,
+		const char *src) {
+	if (*dst == NULL || strcmp(*dst, src) != 0) {
+		*dst = arena_strdup(&head->arena, src);
+	}
+}
+
+struct randr_head *create_head(struct randr_state *state,
+		struct zwlr_output_head_v1 *wlr_head) {
+	struct arena arena = {0};
+	struct randr_head *head = arena_alloc(&arena, sizeof(*head));
+	if (head == NULL) {
+		return NULL;
+	}
+	head->arena = arena;
+	head->state = state;
+	head->wlr_head = wlr_head;
+	head->scale = 1.0;
+	head->reported.scale = wl_fixed_from_int(1);
+	wl_list_init(&head->modes);
+	wl_list_init(&head->free_modes);
+	wl_list_insert(state->heads.prev, &head->link);
+	return head;
+}
+
+void set_head_name(struct randr_head *head, const char *name) {
+	struct hash_table *heads_by_name = &head->state->heads_by_name;
+	if (head->name != NULL) {
+		hash_table_remove(heads_by_name, hash_string(head->name), head);
+	}
+	replace_string(head, &head->name, name);
+	if (head->name != NULL &&
+			!hash_table_insert(heads_by_name, hash_string(head->name), head)) {
+		fprintf(stderr, "failed to index output %s\n", head->name);
+	}
+}
+
+struct randr_mode *create_mode(struct randr_head *head,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_mode *mode;
+	if (!wl_list_empty(&head->free_modes)) {
+		mode = wl_container_of(head->free_modes.next, mode, link);
+		wl_list_remove(&mode->link);
+		*mode = (struct randr_mode){0};
+	} else {
+		mode = arena_alloc(&head->arena, sizeof(*mode));
+		if (mode == NULL) {
+			return NULL;
+		}
+	}
+	mode->head = head;
+	mode->wlr_mode = wlr_mode;
+	mode->seq = head->next_mode_seq++;
+	wl_list_insert(head->modes.prev, &mode->link);
+	invalidate_sorted_modes(head);
+
+	if (!hash_table_insert(&head->modes_by_proxy, hash_ptr(wlr_mode), mode)) {
+		fprintf(stderr, "failed to index mode\n");
+	}
+	return mode;
+}
+
+void set_mode_size(struct randr_mode *mode, int32_t width, int32_t height) {
+	mode->width = width;
+	mode->height = height;
+	invalidate_sorted_modes(mode->head);
+}
+
+struct randr_head *find_head(struct randr_state *state, const char *name) {
+	struct hash_iter iter;
+	struct randr_head *head =
+		hash_table_first(&state->heads_by_name, hash_string(name), &iter);
+	for (; head != NULL; head = hash_table_next(&state->heads_by_name, &iter)) {
+		if (strcmp(head->name, name) == 0) {
+			return head;
+		}
+	}
+	return NULL;
+}
+
+struct randr_mode *find_mode_by_proxy(struct randr_head *head,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct hash_iter iter;
+	struct randr_mode *mode = hash_table_first(&head->modes_by_proxy,
+		hash_ptr(wlr_mode), &iter);
+	for (; mode != NULL; mode = hash_table_next(&head->modes_by_proxy, &iter)) {
+		if (mode->wlr_mode == wlr_mode) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+void free_head(struct randr_head *head) {
+	if (head->name != NULL) {
+		hash_table_remove(&head->state->heads_by_name,
+			hash_string(head->name), head);
+	}
+	wl_list_remove(&head->link);
+	hash_table_finish(&head->modes_by_proxy);
+	finish_sorted_modes(head);
+
+	// The head is part of its own arena
+	struct arena arena = head->arena;
+	arena_finish(&arena);
+}
+
+static void release_mode(struct randr_mode *mode) {
+	if (zwlr_output_mode_v1_get_version(mode->wlr_mode) >= 3) {
+		zwlr_output_mode_v1_release(mode->wlr_mode);
+	} else {
+		zwlr_output_mode_v1_destroy(mode->wlr_mode);
+	}
+}
+
+// The record is kept in the head arena for the next mode event
+static void destroy_mode(struct randr_mode *mode) {
+	struct randr_head *head = mode->head;
+	if (head->mode == mode) {
+		head->mode = NULL;
+	}
+	if (head->reported.mode == mode) {
+		head->reported.mode = NULL;
+	}
+	hash_table_remove(&head->modes_by_proxy, hash_ptr(mode->wlr_mode), mode);
+	wl_list_remove(&mode->link);
+	invalidate_sorted_modes(head);
+	release_mode(mode);
+	wl_list_insert(&head->free_modes, &mode->link);
+}
+
+static void destroy_head(struct randr_head *head) {
+	struct randr_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		release_mode(mode);
+	}
+	if (zwlr_output_head_v1_get_version(head->wlr_head) >= 3) {
+		zwlr_output_head_v1_release(head->wlr_head);
+	} else {
+		zwlr_output_head_v1_destroy(head->wlr_head);
+	}
+	free_head(head);
+}
+
+static void mode_handle_size(void *data, struct zwlr_output_mode_v1 *wlr_mode,
+		int32_t width, int32_t height) {
+	struct randr_mode *mode = data;
+	mode->head->state->events[RANDR_EVENT_MODE_SIZE]++;
+	set_mode_size(mode, width, height);
+}
+
+static void mode_handle_refresh(void *data,
+		struct zwlr_output_mode_v1 *wlr_mode, int32_t refresh) {
+	struct randr_mode *mode = data;
+	mode->head->state->events[RANDR_EVENT_MODE_REFRESH]++;
+	mode->refresh = refresh;
+	invalidate_sorted_modes(mode->head);
+}
+
+static void mode_handle_preferred(void *data,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_mode *mode = data;
+	mode->head->state->events[RANDR_EVENT_MODE_PREFERRED]++;
+	mode->preferred = true;
+}
+
+static void mode_handle_finished(void *data,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_mode *mode = data;
+	mode->head->state->events[RANDR_EVENT_MODE_FINISHED]++;
+	destroy_mode(mode);
+}
+
+static const struct zwlr_output_mode_v1_listener mode_listener = {
+	.size = mode_handle_size,
+	.refresh = mode_handle_refresh,
+	.preferred = mode_handle_preferred,
+	.finished = mode_handle_finished,
+};
+
+static void head_handle_name(void *data,
+		struct zwlr_output_head_v1 *wlr_head, const char *name) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_NAME]++;
+	set_head_name(head, name);
+}
+
+static void head_handle_description(void *data,
+		struct zwlr_output_head_v1 *wlr_head, const char *description) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_DESCRIPTION]++;
+	replace_string(head, &head->description, description);
+}
+
+static void head_handle_physical_size(void *data,
+		struct zwlr_output_head_v1 *wlr_head, int32_t width, int32_t height) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_PHYSICAL_SIZE]++;
+	head->phys_width = width;
+	head->phys_height = height;
+}
+
+static void head_handle_mode(void *data,
+		struct zwlr_output_head_v1 *wlr_head,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_MODE]++;
+	struct randr_mode *mode = create_mode(head, wlr_mode);
+	if (mode == NULL) {
+		fprintf(stderr, "failed to allocate mode\n");
+		return;
+	}
+	zwlr_output_mode_v1_add_listener(wlr_mode, &mode_listener, mode);
+}
+
+static void head_handle_enabled(void *data,
+		struct zwlr_output_head_v1 *wlr_head, int32_t enabled) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_ENABLED]++;
+	head->enabled = head->reported.enabled = !!enabled;
+	if (!enabled) {
+		head->mode = head->reported.mode = NULL;
+	}
+}
+
+static void head_handle_current_mode(void *data,
+		struct zwlr_output_head_v1 *wlr_head,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_CURRENT_MODE]++;
+	head->mode = head->reported.mode = find_mode_by_proxy(head, wlr_mode);
+	if (head->mode == NULL) {
+		fprintf(stderr, "received unknown current_mode\n");
+	}
+}
+
+static void head_handle_position(void *data,
+		struct zwlr_output_head_v1 *wlr_head, int32_t x, int32_t y) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_POSITION]++;
+	head->x = head->reported.x = x;
+	head->y = head->reported.y = y;
+}
+
+static void head_handle_transform(void *data,
+		struct zwlr_output_head_v1 *wlr_head, int32_t transform) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_TRANSFORM]++;
+	head->transform = head->reported.transform = transform;
+}
+
+static void head_handle_scale(void *data,
+		struct zwlr_output_head_v1 *wlr_head, wl_fixed_t scale) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_SCALE]++;
+	head->scale = wl_fixed_to_double(scale);
+	head->reported.scale = scale;
+}
+
+static void head_handle_finished(void *data,
+		struct zwlr_output_head_v1 *wlr_head) {
+	struct randr_head *head = data;
+	struct randr_state *state = head->state;
+	state->events[RANDR_EVENT_HEAD_FINISHED]++;
+	if (state->listener != NULL && state->listener->head_finished != NULL) {
+		state->listener->head_finished(state->listener_data, head);
+	}
+	destroy_head(head);
+}
+
+static void head_handle_make(void *data,
+		struct zwlr_output_head_v1 *wlr_head, const char *make) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_MAKE]++;
+	replace_string(head, &head->make, make);
+}
+
+static void head_handle_model(void *data,
+		struct zwlr_output_head_v1 *wlr_head, const char *model) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_MODEL]++;
+	replace_string(head, &head->model, model);
+}
+
+static void head_handle_serial_number(void *data,
+		struct zwlr_output_head_v1 *wlr_head, const char *serial_number) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_SERIAL_NUMBER]++;
+	replace_string(head, &head->serial_number, serial_number);
+}
+
+static void head_handle_adaptive_sync(void *data,
+		struct zwlr_output_head_v1 *wlr_head, uint32_t state) {
+	struct randr_head *head = data;
+	head->state->events[RANDR_EVENT_HEAD_ADAPTIVE_SYNC]++;
+	head->adaptive_sync_state = head->reported.adaptive_sync_state = state;
+}
+
+static const struct zwlr_output_head_v1_listener head_listener = {
+	.name = head_handle_name,
+	.description = head_handle_description,
+	.physical_size = head_handle_physical_size,
+	.mode = head_handle_mode,
+	.enabled = head_handle_enabled,
+	.current_mode = head_handle_current_mode,
+	.position = head_handle_position,
+	.transform = head_handle_transform,
+	.scale = head_handle_scale,
+	.finished = head_handle_finished,
+	.make = head_handle_make,
+	.model = head_handle_model,
+	.serial_number = head_handle_serial_number,
+	.adaptive_sync = head_handle_adaptive_sync,
+};
+
+static void output_manager_handle_head(void *data,
+		struct zwlr_output_manager_v1 *manager,
+		struct zwlr_output_head_v1 *wlr_head) {
+	struct randr_state *state = data;
+	state->events[RANDR_EVENT_MANAGER_HEAD]++;
+	struct randr_head *head = create_head(state, wlr_head);
+	if (head == NULL) {
+		fprintf(stderr, "failed to allocate output\n");
+		return;
+	}
+	zwlr_output_head_v1_add_listener(wlr_head, &head_listener, head);
+}
+
+static void output_manager_handle_done(void *data,
+		struct zwlr_output_manager_v1 *manager, uint32_t serial) {
+	struct randr_state *state = data;
+	state->events[RANDR_EVENT_MANAGER_DONE]++;
+	state->serial = serial;
+	state->has_serial = true;
+
+	// Lookups follow, and modes don't change until the next batch
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		sort_modes(head);
+	}
+
+	if (state->listener != NULL && state->listener->done != NULL) {
+		state->listener->done(state->listener_data, state);
+	}
+}
+
+static void output_manager_handle_finished(void *data,
+		struct zwlr_output_manager_v1 *manager) {
+	struct randr_state *state = data;
+	state->events[RANDR_EVENT_MANAGER_FINISHED]++;
+}
+
+static const struct zwlr_output_manager_v1_listener output_manager_listener = {
+	.head = output_manager_handle_head,
+	.done = output_manager_handle_done,
+	.finished = output_manager_handle_finished,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	struct randr_state *state = data;
+	state->events[RANDR_EVENT_REGISTRY_GLOBAL]++;
+
+	if (strcmp(interface, zwlr_output_manager_v1_interface.name) == 0) {
+		uint32_t version_to_bind = version <= 4 ? version : 4;
+		state->output_manager = wl_registry_bind(registry, name,
+			&zwlr_output_manager_v1_interface, version_to_bind);
+		state->version = version_to_bind;
+		zwlr_output_manager_v1_add_listener(state->output_manager,
+			&output_manager_listener, state);
+	} else if (strcmp(interface,
+			zwlr_output_power_manager_v1_interface.name) == 0) {
+		state->power_manager_name = name;
+	} else if (strcmp(interface, wl_output_interface.name) == 0) {
+		struct output_global *global =
+			wl_array_add(&state->output_globals, sizeof(*global));
+		if (global == NULL) {
+			fprintf(stderr, "failed to allocate output global\n");
+			return;
+		}
+		*global = (struct output_global){ .name = name, .version = version };
+	}
+}
+
+static void registry_handle_global_remove(void *data,
+		struct wl_registry *registry, uint32_t name) {
+	struct randr_state *state = data;
+	if (state->power_manager_name == name) {
+		state->power_manager_name = 0;
+	}
+
+	struct output_global *globals = state->output_globals.data;
+	size_t len = state->output_globals.size / sizeof(*globals);
+	for (size_t i = 0; i < len; i++) {
+		if (globals[i].name == name) {
+			globals[i] = globals[len - 1];
+			state->output_globals.size -= sizeof(*globals);
+			break;
+		}
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static bool has_serial(void *data) {
+	const struct randr_state *state = data;
+	return state->has_serial;
+}
+
+// Binds the output manager and waits for the first state, returns an exit code
+int enumerate_state(struct randr_state *state, struct wl_display *display,
+		double deadline, struct wl_registry **registry) {
+	double start = timings_now();
+	*registry = wl_display_get_registry(display);
+	wl_registry_add_listener(*registry, &registry_listener, state);
+
+	enum dispatch_result dispatched = roundtrip_until(display, deadline);
+	if (dispatched != DISPATCH_DONE) {
+		return dispatch_exit_code(dispatched);
+	}
+	start = record_phase(&state->timings, RANDR_PHASE_REGISTRY, start);
+
+	if (state->output_manager == NULL) {
+		fprintf(stderr, "compositor doesn't support "
+			"wlr-output-management-unstable-v1\n");
+		return EXIT_FAILURE;
+	}
+
+	dispatched = dispatch_until(display, deadline, has_serial, state);
+	if (dispatched != DISPATCH_DONE) {
+		return dispatch_exit_code(dispatched);
+	}
+	record_phase(&state->timings, RANDR_PHASE_ENUMERATE, start);
+	return EXIT_SUCCESS;
+}
+
+void destroy_state(struct randr_state *state) {
+	struct randr_head *head, *tmp_head;
+	wl_list_for_each_safe(head, tmp_head, &state->heads, link) {
+		struct randr_mode *mode;
+		wl_list_for_each(mode, &head->modes, link) {
+			zwlr_output_mode_v1_destroy(mode->wlr_mode);
+		}
+		zwlr_output_head_v1_destroy(head->wlr_head);
+		free_head(head);
+	}
+	hash_table_finish(&state->heads_by_name);
+	wl_array_release(&state->output_globals);
+	zwlr_output_manager_v1_destroy(state->output_manager);
+}
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * Layouts the compositor accepted with --test-then-apply, so that applying
+ * them again can skip the test. The file is an array of layout keys in
+ * native byte order, oldest first, in the runtime directory of the
+ * compositor.
+ *
+ * A key hashes the fingerprint of the connected monitors with the target
+ * configuration of every head, in any order. It is dropped again if an
+ * apply without test fails.
+ */
+
+#define MAX_TESTED 64
+
+static bool get_tested_path(char *path, size_t size) {
+	return get_runtime_path(path, size, "-tested");
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t head_config_hash(const struct randr_state *state,
+		const struct head_config *config) {
+	struct buffer buf = {0};
+	buffer_append_str(&buf, config->name != NULL ? config->name : "");
+	if (config->enabled) {
+		buffer_printf(&buf, "\x1f%d %d %d %d %d %d %d %d",
+			config->has_mode, config->custom, config->width,
+			config->height, config->refresh, config->x, config->y,
+			config->transform);
+		buffer_printf(&buf, " %d", wl_fixed_from_double(config->scale));
+		if (state->version >= 4) {
+			buffer_printf(&buf, " %d", config->adaptive_sync_state);
+		}
+	}
+	uint64_t hash = hash_bytes64(HASH_BYTES64_INIT, buf.data, buf.len);
+	buffer_finish(&buf);
+	return hash;
+}
+
+bool tested_layout_key(struct randr_state *state,
+		const struct layout_snapshot *target, uint64_t *key) {
+	uint64_t fingerprint;
+	if (!state_fingerprint(state, &fingerprint)) {
+		return false;
+	}
+	uint64_t *hashes = calloc(target->len + 1, sizeof(*hashes));
+	if (hashes == NULL) {
+		fprintf(stderr, "failed to allocate layout key\n");
+		return false;
+	}
+	for (size_t i = 0; i < target->len; i++) {
+		hashes[i] = head_config_hash(state, &target->heads[i]);
+	}
+	qsort(hashes, target->len, sizeof(*hashes), compare_u64);
+
+	uint64_t hash = hash_bytes64(HASH_BYTES64_INIT,
+		&fingerprint, sizeof(fingerprint));
+	*key = hash_bytes64(hash, hashes, target->len * sizeof(*hashes));
+	free(hashes);
+	return true;
+}
+
+// Returns the number of keys read
+static size_t read_tested(uint64_t keys[static MAX_TESTED]) {
+	char path[PATH_MAX];
+	if (!get_tested_path(path, sizeof(path))) {
+		return 0;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	ssize_t n = read(fd, keys, MAX_TESTED * sizeof(*keys));
+	close(fd);
+	return n > 0 ? (size_t)n / sizeof(*keys) : 0;
+}
+
+static void write_tested(const uint64_t *keys, size_t len) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!get_tested_path(path, sizeof(path))) {
+		return;
+	}
+	int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		return;
+	}
+
+	// Readers never see a partial file
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return;
+	}
+	size_t size = len * sizeof(*keys);
+	bool ok = write(fd, keys, size) == (ssize_t)size;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+	}
+}
+
+static size_t find_tested(const uint64_t *keys, size_t len, uint64_t key) {
+	for (size_t i = 0; i < len; i++) {
+		if (keys[i] == key) {
+			return i;
+		}
+	}
+	return len;
+}
+
+bool is_tested_layout(uint64_t key) {
+	uint64_t keys[MAX_TESTED];
+	size_t len = read_tested(keys);
+	return find_tested(keys, len, key) < len;
+}
+
+// Moves the key to the end, evicting the oldest one if full
+void add_tested_layout(uint64_t key) {
+	uint64_t keys[MAX_TESTED];
+	size_t len = read_tested(keys);
+	size_t i = find_tested(keys, len, key);
+	if (i == len && len == MAX_TESTED) {
+		i = 0;
+	} else if (i == len) {
+		len++;
+	}
+	memmove(&keys[i], &keys[i + 1], (len - 1 - i) * sizeof(*keys));
+	keys[len - 1] = key;
+	write_tested(keys, len);
+}
+
+void remove_tested_layout(uint64_t key) {
+	uint64_t keys[MAX_TESTED];
+	size_t len = read_tested(keys);
+	size_t i = find_tested(keys, len, key);
+	if (i == len) {
+		return;
+	}
+	memmove(&keys[i], &keys[i + 1], (len - 1 - i) * sizeof(*keys));
+	write_tested(keys, len - 1);
+}
@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "randr.h"
+
+static const char *phase_names[RANDR_PHASE_COUNT] = {
+	[RANDR_PHASE_CONNECT] = "connect",
+	[RANDR_PHASE_REGISTRY] = "registry",
+	[RANDR_PHASE_ENUMERATE] = "enumerate",
+	[RANDR_PHASE_PARSE] = "parse",
+	[RANDR_PHASE_CREATE] = "create",
+	[RANDR_PHASE_TEST] = "test",
+	[RANDR_PHASE_APPLY] = "apply",
+	[RANDR_PHASE_DONE] = "done",
+	[RANDR_PHASE_OUTPUT] = "output",
+};
+
+static const char *event_names[RANDR_EVENT_COUNT] = {
+	[RANDR_EVENT_REGISTRY_GLOBAL] = "registry.global",
+	[RANDR_EVENT_MANAGER_HEAD] = "manager.head",
+	[RANDR_EVENT_MANAGER_DONE] = "manager.done",
+	[RANDR_EVENT_MANAGER_FINISHED] = "manager.finished",
+	[RANDR_EVENT_HEAD_NAME] = "head.name",
+	[RANDR_EVENT_HEAD_DESCRIPTION] = "head.description",
+	[RANDR_EVENT_HEAD_PHYSICAL_SIZE] = "head.physical_size",
+	[RANDR_EVENT_HEAD_MODE] = "head.mode",
+	[RANDR_EVENT_HEAD_ENABLED] = "head.enabled",
+	[RANDR_EVENT_HEAD_CURRENT_MODE] = "head.current_mode",
+	[RANDR_EVENT_HEAD_POSITION] = "head.position",
+	[RANDR_EVENT_HEAD_TRANSFORM] = "head.transform",
+	[RANDR_EVENT_HEAD_SCALE] = "head.scale",
+	[RANDR_EVENT_HEAD_FINISHED] = "head.finished",
+	[RANDR_EVENT_HEAD_MAKE] = "head.make",
+	[RANDR_EVENT_HEAD_MODEL] = "head.model",
+	[RANDR_EVENT_HEAD_SERIAL_NUMBER] = "head.serial_number",
+	[RANDR_EVENT_HEAD_ADAPTIVE_SYNC] = "head.adaptive_sync",
+	[RANDR_EVENT_MODE_SIZE] = "mode.size",
+	[RANDR_EVENT_MODE_REFRESH] = "mode.refresh",
+	[RANDR_EVENT_MODE_PREFERRED] = "mode.preferred",
+	[RANDR_EVENT_MODE_FINISHED] = "mode.finished",
+};
+
+double timings_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the current time, so that phases can be chained
+double record_phase(struct randr_timings *timings, enum randr_phase phase,
+		double start) {
+	double end = timings_now();
+	timings->phases[phase] += end - start;
+	timings->recorded |= 1u << phase;
+	return end;
+}
+
+void merge_timings(struct randr_timings *dst, const struct randr_timings *src) {
+	for (int i = 0; i < RANDR_PHASE_COUNT; i++) {
+		dst->phases[i] += src->phases[i];
+	}
+	dst->recorded |= src->recorded;
+	dst->attempts += src->attempts;
+}
+
+void print_phase_timings(const char *label,
+		const struct randr_timings *timings) {
+	fprintf(stderr, "%s:", label);
+	for (int i = 0; i < RANDR_PHASE_COUNT; i++) {
+		if (timings->recorded & (1u << i)) {
+			fprintf(stderr, " %s %.3f ms", phase_names[i],
+				timings->phases[i] * 1e3);
+		}
+	}
+	if (timings->attempts > 1) {
+		fprintf(stderr, " (%d attempts)", timings->attempts);
+	}
+	fprintf(stderr, "\n");
+}
+
+void print_timings(struct randr_state *state, bool json) {
+	const struct randr_timings *timings = &state->timings;
+	double total = 0;
+	for (int i = 0; i < RANDR_PHASE_COUNT; i++) {
+		total += timings->phases[i];
+	}
+
+	struct buffer buf = {0};
+	if (json) {
+		buffer_append_str(&buf, "{\"phases\":{");
+		bool first = true;
+		for (int i = 0; i < RANDR_PHASE_COUNT; i++) {
+			if (!(timings->recorded & (1u << i))) {
+				continue;
+			}
+			buffer_printf(&buf, "%s\"%s\":%.3f", first ? "" : ",",
+				phase_names[i], timings->phases[i] * 1e3);
+			first = false;
+		}
+		buffer_printf(&buf, "},\"total\":%.3f,\"attempts\":%d,\"events\":{",
+			total * 1e3, timings->attempts);
+		first = true;
+		for (int i = 0; i < RANDR_EVENT_COUNT; i++) {
+			if (state->events[i] == 0) {
+				continue;
+			}
+			buffer_printf(&buf, "%s\"%s\":", first ? "" : ",", event_names[i]);
+			buffer_append_int(&buf, state->events[i]);
+			first = false;
+		}
+		buffer_append_str(&buf, "}}\n");
+	} else {
+		buffer_append_str(&buf, "Timings:\n");
+		for (int i = 0; i < RANDR_PHASE_COUNT; i++) {
+			if (timings->recorded & (1u << i)) {
+				buffer_printf(&buf, "  %s: %.3f ms\n", phase_names[i],
+					timings->phases[i] * 1e3);
+			}
+		}
+		buffer_printf(&buf, "  total: %.3f ms\n", total * 1e3);
+		if (timings->attempts > 1) {
+			buffer_printf(&buf, "  attempts: %d\n", timings->attempts);
+		}
+		buffer_append_str(&buf, "Events:\n");
+		for (int i = 0; i < RANDR_EVENT_COUNT; i++) {
+			if (state->events[i] > 0) {
+				buffer_printf(&buf, "  %s: ", event_names[i]);
+				buffer_append_int(&buf, state->events[i]);
+				buffer_append_str(&buf, "\n");
+			}
+		}
+	}
+	buffer_write(&buf, STDERR_FILENO);
+	buffer_finish(&buf);
+}
@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+/*
+ * Applies are done in phases: the configuration is built (create),
+ * optionally tested (test), applied (apply), and finally the new state is
+ * received from the compositor (done). A cancelled configuration is built
+ * again from the recorded target layout once the new serial is known. All
+ * of this, retries included, has to finish before the apply timeout.
+ *
+ * With --confirm, the previous layout is applied again unless the user
+ * confirms the new one in time.
+ *
+ * --test-then-apply tests the configuration and applies it in the same
+ * connection, and records the layout as known to work so that the test is
+ * skipped the next time, see tested.c.
+ *
+ * Applies of several processes are coordinated so that they don't cancel
+ * each other, see coordinator.c.
+ */
+
+#define MAX_ATTEMPTS 4
+
+enum config_result {
+	CONFIG_PENDING,
+	CONFIG_SUCCEEDED,
+	CONFIG_FAILED,
+	CONFIG_CANCELLED,
+};
+
+bool take_layout_snapshot(struct randr_state *state,
+		struct layout_snapshot *snapshot) {
+	*snapshot = (struct layout_snapshot){0};
+	size_t len = wl_list_length(&state->heads);
+	snapshot->heads = calloc(len + 1, sizeof(*snapshot->heads));
+	if (snapshot->heads == NULL) {
+		fprintf(stderr, "failed to allocate layout snapshot\n");
+		return false;
+	}
+
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		struct head_config *config = &snapshot->heads[snapshot->len++];
+		*config = (struct head_config){
+			.name = head->name != NULL ? strdup(head->name) : NULL,
+			.changed = head->changed,
+			.enabled = head->enabled,
+			.x = head->x,
+			.y = head->y,
+			.transform = head->transform,
+			.scale = head->scale,
+			.adaptive_sync_state = head->adaptive_sync_state,
+		};
+		if (head->mode != NULL) {
+			config->has_mode = true;
+			config->width = head->mode->width;
+			config->height = head->mode->height;
+			config->refresh = head->mode->refresh;
+		} else if (head->changed & RANDR_HEAD_MODE) {
+			config->has_mode = config->custom = true;
+			config->width = head->custom_mode.width;
+			config->height = head->custom_mode.height;
+			config->refresh = head->custom_mode.refresh;
+		}
+	}
+	return true;
+}
+
+void finish_layout_snapshot(struct layout_snapshot *snapshot) {
+	for (size_t i = 0; i < snapshot->len; i++) {
+		free(snapshot->heads[i].name);
+	}
+	free(snapshot->heads);
+	*snapshot = (struct layout_snapshot){0};
+}
+
+static const struct head_config *find_head_config(
+		const struct layout_snapshot *snapshot, const char *name) {
+	for (size_t i = 0; i < snapshot->len; i++) {
+		const char *config_name = snapshot->heads[i].name;
+		if (config_name != NULL && name != NULL &&
+				strcmp(config_name, name) == 0) {
+			return &snapshot->heads[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * With full set, every property of the snapshot is sent again, else only
+ * the ones which were changed when it was taken.
+ */
+bool restore_layout_snapshot(struct randr_state *state,
+		const struct layout_snapshot *snapshot, bool full) {
+	for (size_t i = 0; i < snapshot->len; i++) {
+		const struct head_config *config = &snapshot->heads[i];
+		if (!full && (config->changed || config->set_enabled) &&
+				(config->name == NULL ||
+				find_head(state, config->name) == NULL)) {
+			log_error("output %s disappeared\n",
+				config->name != NULL ? config->name : "(null)");
+			return false;
+		}
+	}
+
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		const struct head_config *config =
+			find_head_config(snapshot, head->name);
+		head->changed = 0;
+		if (config == NULL) {
+			continue;
+		}
+
+		if (full || config->set_enabled) {
+			head->enabled = config->enabled;
+		}
+
+		uint32_t changed = config->changed;
+		if (full) {
+			changed = RANDR_HEAD_POSITION | RANDR_HEAD_TRANSFORM |
+				RANDR_HEAD_SCALE;
+			if (config->has_mode) {
+				changed |= RANDR_HEAD_MODE;
+			}
+			if (state->version >=
+					ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_SET_ADAPTIVE_SYNC_SINCE_VERSION) {
+				changed |= RANDR_HEAD_ADAPTIVE_SYNC;
+			}
+		}
+
+		if ((changed & RANDR_HEAD_MODE) && config->custom) {
+			head->mode = NULL;
+			head->custom_mode.width = config->width;
+			head->custom_mode.height = config->height;
+			head->custom_mode.refresh = config->refresh;
+		} else if (changed & RANDR_HEAD_MODE) {
+			struct randr_mode *mode = find_mode(head,
+				config->width, config->height, config->refresh);
+			if (mode == NULL) {
+				log_error("mode %dx%d@%d mHz is no longer available on %s\n",
+					config->width, config->height, config->refresh,
+					head->name);
+				return false;
+			}
+			head->mode = mode;
+		}
+		if (changed & RANDR_HEAD_POSITION) {
+			head->x = config->x;
+			head->y = config->y;
+		}
+		if (changed & RANDR_HEAD_TRANSFORM) {
+			head->transform = config->transform;
+		}
+		if (changed & RANDR_HEAD_SCALE) {
+			head->scale = config->scale;
+		}
+		if (changed & RANDR_HEAD_ADAPTIVE_SYNC) {
+			head->adaptive_sync_state = config->adaptive_sync_state;
+		}
+		head->changed = changed;
+	}
+	return true;
+}
+
+static void config_handle_succeeded(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	enum config_result *result = data;
+	zwlr_output_configuration_v1_destroy(config);
+	*result = CONFIG_SUCCEEDED;
+}
+
+static void config_handle_failed(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	enum config_result *result = data;
+	zwlr_output_configuration_v1_destroy(config);
+	*result = CONFIG_FAILED;
+}
+
+static void config_handle_cancelled(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	enum config_result *result = data;
+	zwlr_output_configuration_v1_destroy(config);
+	*result = CONFIG_CANCELLED;
+}
+
+static const struct zwlr_output_configuration_v1_listener config_listener = {
+	.succeeded = config_handle_succeeded,
+	.failed = config_handle_failed,
+	.cancelled = config_handle_cancelled,
+};
+
+static bool config_done(void *data) {
+	const enum config_result *result = data;
+	return *result != CONFIG_PENDING;
+}
+
+static enum dispatch_result send_configuration(struct randr_state *state,
+		struct wl_display *display, bool test, double deadline,
+		enum config_result *result, struct randr_timings *timings) {
+	*result = CONFIG_PENDING;
+	double start = timings_now();
+	struct zwlr_output_configuration_v1 *config =
+		apply_state(state, test, &config_listener, result);
+	if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+		fprintf(stderr, "wl_display_flush failed\n");
+		zwlr_output_configuration_v1_destroy(config);
+		return DISPATCH_FAILED;
+	}
+	double sent = record_phase(timings, RANDR_PHASE_CREATE, start);
+
+	enum dispatch_result dispatched =
+		dispatch_until(display, deadline, config_done, result);
+	if (dispatched != DISPATCH_DONE) {
+		// The result would be written to a stale pointer
+		zwlr_output_configuration_v1_destroy(config);
+		return dispatched;
+	}
+	record_phase(timings, test ? RANDR_PHASE_TEST : RANDR_PHASE_APPLY, sent);
+	return DISPATCH_DONE;
+}
+
+struct serial_wait {
+	const struct randr_state *state;
+	uint32_t serial;
+};
+
+static bool serial_changed(void *data) {
+	const struct serial_wait *wait = data;
+	return wait->state->serial != wait->serial;
+}
+
+// Wait for the state following a configuration, and for the new serial
+static enum dispatch_result wait_for_done(struct randr_state *state,
+		struct wl_display *display, uint32_t serial, bool required,
+		double deadline) {
+	if (state->serial == serial && !required) {
+		// Nothing may have changed, in which case no done event comes
+		return roundtrip_until(display, deadline);
+	}
+	struct serial_wait wait = { .state = state, .serial = serial };
+	return dispatch_until(display, deadline, serial_changed, &wait);
+}
+
+// Goes back to what the compositor last reported
+void reset_heads(struct randr_state *state) {
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		head->changed = 0;
+		head->enabled = head->reported.enabled;
+		head->mode = head->reported.mode;
+		head->custom_mode.width = 0;
+		head->custom_mode.height = 0;
+		head->custom_mode.refresh = 0;
+		head->x = head->reported.x;
+		head->y = head->reported.y;
+		head->transform = head->reported.transform;
+		head->scale = wl_fixed_to_double(head->reported.scale);
+		head->adaptive_sync_state = head->reported.adaptive_sync_state;
+	}
+}
+
+// Returns an exit code, EXIT_TIMEOUT if the deadline passed
+int apply_snapshot(struct randr_state *state,
+		struct wl_display *display, const struct layout_snapshot *snapshot,
+		bool full, bool test_first, bool dry_run, double deadline,
+		struct randr_timings *timings) {
+	for (int attempt = 1; attempt <= MAX_ATTEMPTS; attempt++) {
+		timings->attempts = attempt;
+		if (!restore_layout_snapshot(state, snapshot, full)) {
+			return EXIT_FAILURE;
+		}
+
+		uint32_t serial = state->serial;
+		enum config_result result = CONFIG_SUCCEEDED;
+		enum dispatch_result dispatched = DISPATCH_DONE;
+		if (test_first || dry_run) {
+			dispatched = send_configuration(state, display, true, deadline,
+				&result, timings);
+		}
+		if (dispatched == DISPATCH_DONE && result == CONFIG_SUCCEEDED &&
+				!dry_run) {
+			dispatched = send_configuration(state, display, false, deadline,
+				&result, timings);
+		}
+		if (dispatched != DISPATCH_DONE) {
+			return dispatch_exit_code(dispatched);
+		}
+
+		if (result == CONFIG_FAILED) {
+			log_error("failed to apply configuration\n");
+			return EXIT_FAILURE;
+		} else if (result == CONFIG_SUCCEEDED) {
+			if (dry_run) {
+				return EXIT_SUCCESS;
+			}
+			double start = timings_now();
+			dispatched = wait_for_done(state, display, serial, false, deadline);
+			record_phase(timings, RANDR_PHASE_DONE, start);
+			return dispatch_exit_code(dispatched);
+		}
+
+		// Cancelled, the state changed under us: try again on top of it
+		dispatched = wait_for_done(state, display, serial, true, deadline);
+		if (dispatched != DISPATCH_DONE) {
+			return dispatch_exit_code(dispatched);
+		}
+	}
+
+	log_error("configuration cancelled %d times, giving up\n",
+		MAX_ATTEMPTS);
+	return EXIT_FAILURE;
+}
+
+static bool wait_for_confirmation(struct wl_display *display, int seconds) {
+	fprintf(stderr, "Keep this configuration? [y/N] "
+		"Reverting in %d seconds\n", seconds);
+
+	double deadline = timings_now() + seconds;
+	while (1) {
+		if (timings_now() >= deadline) {
+			fprintf(stderr, "no confirmation received\n");
+			return false;
+		}
+
+		struct pollfd fds[] = {
+			{0}, // display
+			{ .fd = STDIN_FILENO, .events = POLLIN },
+		};
+		if (poll_display(display, fds, 2, deadline) < 0) {
+			return false;
+		}
+		if (fds[1].revents & (POLLIN | POLLHUP)) {
+			char answer[64];
+			ssize_t len = read(STDIN_FILENO, answer, sizeof(answer));
+			return len > 0 && (answer[0] == 'y' || answer[0] == 'Y');
+		}
+	}
+}
+
+int run_transaction(struct randr_state *state, struct wl_display *display,
+		const struct layout_snapshot *original,
+		const struct randr_command *cmd) {
+	if (cmd->no_op_skip && !layout_differs(state)) {
+		// Already in place
+		return EXIT_SUCCESS;
+	}
+
+	struct layout_snapshot target;
+	if (!take_layout_snapshot(state, &target)) {
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < target.len; i++) {
+		const struct head_config *before =
+			find_head_config(original, target.heads[i].name);
+		target.heads[i].set_enabled = before == NULL ||
+			before->enabled != target.heads[i].enabled;
+	}
+
+	// A layout which passed the test before goes straight to apply
+	bool transactional = cmd->confirm > 0;
+	bool test_first = transactional;
+	uint64_t key;
+	bool has_key = cmd->test_then_apply &&
+		tested_layout_key(state, &target, &key);
+	if (cmd->test_then_apply) {
+		test_first = test_first || !has_key || !is_tested_layout(key);
+	}
+
+	// Nothing else may be applied until the layout is confirmed or reverted
+	double deadline = deadline_after(cmd->apply_timeout);
+	int lock_fd = -1;
+	if (transactional && open_apply_lock(deadline, &lock_fd) != EXIT_SUCCESS) {
+		finish_layout_snapshot(&target);
+		log_error("timed out waiting for other applies\n");
+		return EXIT_TIMEOUT;
+	}
+
+	// Tests don't change the serial, other applies are merged with this one
+	struct randr_timings timings = {0};
+	int exit_code;
+	if (cmd->dry_run || transactional) {
+		exit_code = apply_snapshot(state, display, &target, false,
+			test_first, cmd->dry_run, deadline, &timings);
+	} else {
+		exit_code = coordinate_apply(state, display, &target, test_first,
+			deadline, &timings);
+	}
+	finish_layout_snapshot(&target);
+	if (has_key && exit_code == EXIT_SUCCESS) {
+		add_tested_layout(key);
+	} else if (has_key && exit_code == EXIT_FAILURE) {
+		remove_tested_layout(key);
+	}
+	merge_timings(&state->timings, &timings);
+	if (cmd->timings) {
+		print_phase_timings("apply", &timings);
+	}
+	if (exit_code != EXIT_SUCCESS || !transactional) {
+		close_apply_lock(lock_fd);
+		return exit_code;
+	}
+
+	if (wait_for_confirmation(display, cmd->confirm)) {
+		close_apply_lock(lock_fd);
+		return EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "reverting to the previous configuration\n");
+	struct randr_timings revert_timings = {0};
+	exit_code = apply_snapshot(state, display, original, true, false,
+		false, deadline_after(cmd->apply_timeout), &revert_timings);
+	merge_timings(&state->timings, &revert_timings);
+	if (exit_code == EXIT_SUCCESS && cmd->timings) {
+		print_phase_timings("revert", &revert_timings);
+	} else if (exit_code != EXIT_SUCCESS) {
+		fprintf(stderr, "failed to revert the configuration\n");
+	}
+	close_apply_lock(lock_fd);
+	return exit_code == EXIT_TIMEOUT ? EXIT_TIMEOUT : EXIT_FAILURE;
+}
@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "randr.h"
+
+enum watch_field {
+	WATCH_ENABLED = 1 << 0,
+	WATCH_MODE = 1 << 1,
+	WATCH_POSITION = 1 << 2,
+	WATCH_TRANSFORM = 1 << 3,
+	WATCH_SCALE = 1 << 4,
+	WATCH_ADAPTIVE_SYNC = 1 << 5,
+};
+
+// What was last reported for a head
+struct watch_snapshot {
+	bool enabled;
+	bool has_mode;
+	int32_t width, height, refresh;
+	int32_t x, y;
+	enum wl_output_transform transform;
+	wl_fixed_t scale;
+	enum zwlr_output_head_v1_adaptive_sync_state adaptive_sync_state;
+};
+
+struct watch_head {
+	struct randr_head *head;
+	struct wl_list link;
+
+	struct watch_snapshot snapshot;
+	uint32_t diff; // enum watch_field
+	bool added;
+};
+
+struct watch {
+	struct wl_list heads; // struct watch_head.link
+	struct hash_table heads_by_head;
+	struct wl_array removed; // char *
+	uint32_t version;
+	struct buffer buf;
+	struct cache_writer *cache; // NULL without --cache
+};
+
+// Heads are edited in place by --auto-profile, only what the compositor
+// reported has happened
+static void take_snapshot(struct watch_snapshot *snapshot,
+		struct randr_head *head) {
+	const struct randr_mode *mode = head->reported.mode;
+	*snapshot = (struct watch_snapshot){
+		.enabled = head->reported.enabled,
+		.has_mode = mode != NULL,
+		.x = head->reported.x,
+		.y = head->reported.y,
+		.transform = head->reported.transform,
+		.scale = head->reported.scale,
+		.adaptive_sync_state = head->reported.adaptive_sync_state,
+	};
+	if (mode != NULL) {
+		snapshot->width = mode->width;
+		snapshot->height = mode->height;
+		snapshot->refresh = mode->refresh;
+	}
+}
+
+static uint32_t compare_snapshots(const struct watch_snapshot *a,
+		const struct watch_snapshot *b) {
+	uint32_t diff = 0;
+	if (a->enabled != b->enabled) {
+		diff |= WATCH_ENABLED;
+	}
+	if (a->has_mode != b->has_mode || a->width != b->width ||
+			a->height != b->height || a->refresh != b->refresh) {
+		diff |= WATCH_MODE;
+	}
+	if (a->x != b->x || a->y != b->y) {
+		diff |= WATCH_POSITION;
+	}
+	if (a->transform != b->transform) {
+		diff |= WATCH_TRANSFORM;
+	}
+	if (a->scale != b->scale) {
+		diff |= WATCH_SCALE;
+	}
+	if (a->adaptive_sync_state != b->adaptive_sync_state) {
+		diff |= WATCH_ADAPTIVE_SYNC;
+	}
+	return diff;
+}
+
+static struct watch_head *find_watch_head(struct watch *watch,
+		struct randr_head *head) {
+	struct hash_iter iter;
+	struct watch_head *watch_head = hash_table_first(&watch->heads_by_head,
+		hash_ptr(head), &iter);
+	for (; watch_head != NULL;
+			watch_head = hash_table_next(&watch->heads_by_head, &iter)) {
+		if (watch_head->head == head) {
+			return watch_head;
+		}
+	}
+	return NULL;
+}
+
+static void print_head_diff(struct watch *watch,
+		struct watch_head *watch_head) {
+	struct buffer *buf = &watch->buf;
+	struct randr_head *head = watch_head->head;
+	const struct watch_snapshot *snapshot = &watch_head->snapshot;
+	uint32_t diff = watch_head->diff;
+
+	buffer_append_str(buf, "{\"name\":");
+	buffer_append_json_string(buf, head->name);
+	if (watch_head->added) {
+		buffer_append_str(buf, ",\"description\":");
+		buffer_append_json_string(buf, head->description);
+		buffer_append_str(buf, ",\"make\":");
+		buffer_append_json_string(buf, head->make);
+		buffer_append_str(buf, ",\"model\":");
+		buffer_append_json_string(buf, head->model);
+		buffer_append_str(buf, ",\"serial\":");
+		buffer_append_json_string(buf, head->serial_number);
+	}
+	if (diff & WATCH_ENABLED) {
+		buffer_append_str(buf, snapshot->enabled ?
+			",\"enabled\":true" : ",\"enabled\":false");
+	}
+	if (diff & WATCH_MODE) {
+		if (snapshot->has_mode) {
+			buffer_printf(buf,
+				",\"mode\":{\"width\":%d,\"height\":%d,\"refresh\":%f}",
+				snapshot->width, snapshot->height,
+				(float)snapshot->refresh / 1000);
+		} else {
+			buffer_append_str(buf, ",\"mode\":null");
+		}
+	}
+	if (diff & WATCH_POSITION) {
+		buffer_printf(buf, ",\"position\":{\"x\":%d,\"y\":%d}",
+			snapshot->x, snapshot->y);
+	}
+	if (diff & WATCH_TRANSFORM) {
+		buffer_append_str(buf, ",\"transform\":");
+		buffer_append_json_string(buf,
+			output_transform_map[snapshot->transform]);
+	}
+	if (diff & WATCH_SCALE) {
+		buffer_printf(buf, ",\"scale\":%f",
+			wl_fixed_to_double(snapshot->scale));
+	}
+	if (diff & WATCH_ADAPTIVE_SYNC) {
+		const char *adaptive_sync = "null";
+		if (watch->version >= 4) {
+			switch (snapshot->adaptive_sync_state) {
+			case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED:
+				adaptive_sync = "true";
+				break;
+			case ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED:
+				adaptive_sync = "false";
+				break;
+			}
+		}
+		buffer_append_str(buf, ",\"adaptive_sync\":");
+		buffer_append_str(buf, adaptive_sync);
+	}
+	buffer_append_str(buf, "}");
+}
+
+static void print_head_list(struct watch *watch, const char *key,
+		bool added) {
+	struct buffer *buf = &watch->buf;
+	size_t count = 0;
+	struct watch_head *watch_head;
+	wl_list_for_each(watch_head, &watch->heads, link) {
+		if (watch_head->added != added || watch_head->diff == 0) {
+			continue;
+		}
+		if (count++) {
+			buffer_append_str(buf, ",");
+		} else {
+			buffer_printf(buf, ",\"%s\":[", key);
+		}
+		print_head_diff(watch, watch_head);
+	}
+	if (count) {
+		buffer_append_str(buf, "]");
+	}
+}
+
+static void watch_handle_done(void *data, struct randr_state *state) {
+	struct watch *watch = data;
+
+	bool changed = watch->removed.size > 0;
+	struct randr_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		struct watch_head *watch_head = find_watch_head(watch, head);
+		struct watch_snapshot snapshot;
+		take_snapshot(&snapshot, head);
+		if (watch_head == NULL) {
+			watch_head = calloc(1, sizeof(*watch_head));
+			if (watch_head == NULL || !hash_table_insert(
+					&watch->heads_by_head, hash_ptr(head), watch_head)) {
+				fprintf(stderr, "failed to allocate head\n");
+				free(watch_head);
+				continue;
+			}
+			watch_head->head = head;
+			watch_head->added = true;
+			watch_head->diff = ~(uint32_t)0;
+			wl_list_insert(watch->heads.prev, &watch_head->link);
+		} else {
+			watch_head->added = false;
+			watch_head->diff = compare_snapshots(&watch_head->snapshot,
+				&snapshot);
+		}
+		watch_head->snapshot = snapshot;
+		changed = changed || watch_head->diff != 0;
+	}
+	if (!changed) {
+		return;
+	}
+
+	struct buffer *buf = &watch->buf;
+	buffer_printf(buf, "{\"serial\":%u", state->serial);
+	print_head_list(watch, "added", true);
+	print_head_list(watch, "changed", false);
+	if (watch->removed.size > 0) {
+		buffer_append_str(buf, ",\"removed\":[");
+		char **name;
+		wl_array_for_each(name, &watch->removed) {
+			if (name != watch->removed.data) {
+				buffer_append_str(buf, ",");
+			}
+			buffer_append_json_string(buf, *name);
+			free(*name);
+		}
+		buffer_append_str(buf, "]");
+		watch->removed.size = 0;
+	}
+	buffer_append_str(buf, "}\n");
+	buffer_write(buf, STDOUT_FILENO);
+	buf->len = 0;
+
+	if (watch->cache != NULL) {
+		write_cache(watch->cache, state);
+	}
+}
+
+static void watch_handle_head_finished(void *data, struct randr_head *head) {
+	struct watch *watch = data;
+	struct watch_head *watch_head = find_watch_head(watch, head);
+	if (watch_head == NULL) {
+		// Never reported, no need to tell anyone it is gone
+		return;
+	}
+
+	char **name = wl_array_add(&watch->removed, sizeof(*name));
+	if (name != NULL) {
+		*name = head->name != NULL ? strdup(head->name) : NULL;
+	}
+	hash_table_remove(&watch->heads_by_head, hash_ptr(head), watch_head);
+	wl_list_remove(&watch_head->link);
+	free(watch_head);
+}
+
+static const struct randr_state_listener watch_listener = {
+	.done = watch_handle_done,
+	.head_finished = watch_handle_head_finished,
+};
+
+int run_watch(struct randr_state *state, struct wl_display *display,
+		const struct randr_command *cmd) {
+	struct cache_writer cache;
+	if (cmd->cache && !start_cache(&cache)) {
+		return EXIT_FAILURE;
+	}
+	struct watch watch = {
+		.version = state->version,
+		.cache = cmd->cache ? &cache : NULL,
+	};
+	struct auto_profile auto_profile = {0};
+	wl_list_init(&watch.heads);
+	wl_array_init(&watch.removed);
+
+	state->listener = &watch_listener;
+	state->listener_data = &watch;
+
+	// Report the initial state as a batch of new heads
+	watch_handle_done(&watch, state);
+
+	// Deltas are printed from the done handler until the connection breaks
+	while (1) {
+		if (cmd->auto_profile) {
+			update_auto_profile(&auto_profile, state, display,
+				cmd->apply_timeout);
+		}
+
+		double deadline = watch.cache != NULL ? touch_cache(watch.cache) : -1;
+		struct pollfd fds[1];
+		if (poll_display(display, fds, 1, deadline) < 0) {
+			break;
+		}
+	}
+
+	state->listener = NULL;
+	state->listener_data = NULL;
+	if (watch.cache != NULL) {
+		finish_cache(watch.cache);
+	}
+
+	struct watch_head *watch_head, *tmp;
+	wl_list_for_each_safe(watch_head, tmp, &watch.heads, link) {
+		wl_list_remove(&watch_head->link);
+		free(watch_head);
+	}
+	hash_table_finish(&watch.heads_by_head);
+	char **name;
+	wl_array_for_each(name, &watch.removed) {
+		free(*name);
+	}
+	wl_array_release(&watch.removed);
+	buffer_finish(&watch.buf);
+	return EXIT_FAILURE;
+}